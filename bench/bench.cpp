@@ -0,0 +1,409 @@
+#include "stb_image.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sys/resource.h>
+#include "depixel.hpp"
+#include "mesh.hpp"
+#include "synth.hpp"
+
+namespace fs = std::filesystem;
+
+struct Options
+{
+	size_t runs = 5;
+	int delta_c = 48;
+	float k0 = 0.3f;
+	float kN = 0.65f;
+	size_t max_iterations = 1000000;
+	bool trace_contours = false;
+	size_t arity = default_arity;
+	bool decimate = false;
+	bool densify = false;
+	bool multilevel = false;
+	bool active_set = false;
+	std::string output;
+	std::vector<fs::path> corpus;
+
+	// synthetic scaling run, used instead of the corpus when sizes are given
+	std::vector<size_t> sizes;
+	std::vector<Fragmentation> fragmentations = { Fragmentation::Flat };
+	size_t palette = 8;
+	uint64_t seed = 1;
+	double budget_s = 60.0;
+	std::string plot;
+};
+
+// wall times of one stage over all runs, in milliseconds
+struct Samples
+{
+	const char *name;
+	std::vector<double> ms;
+
+	// nearest-rank percentile, p in [0, 1]
+	double rank(double p) const
+	{
+		if (ms.empty())
+			return 0.0;
+		auto sorted = ms;
+		std::sort(sorted.begin(), sorted.end());
+		const auto r = size_t(std::ceil(p * double(sorted.size())));
+		return sorted[std::clamp<size_t>(r, 1, sorted.size()) - 1];
+	}
+
+	double median() const { return rank(0.5); }
+
+	void report(std::ostream &os) const
+	{
+		os << "\"" << name << "\": { "
+		   << "\"min_ms\": " << rank(0.0) << ", "
+		   << "\"median_ms\": " << median() << ", "
+		   << "\"p99_ms\": " << rank(0.99) << " }";
+	}
+};
+
+// ru_maxrss is the high-water mark of the whole process, so it is only
+// reported once for the run rather than per image
+static long peakRssKb()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+static void usage(const char *argv0)
+{
+	std::cerr << "Usage: " << argv0 << " [options] [image.png | directory]...\n"
+		  << "  -n <runs>            runs per image (default 5)\n"
+		  << "  -d <delta_c>         cluster threshold (default 48)\n"
+		  << "  -k0 <value>          local spring stiffness (default 0.3)\n"
+		  << "  -kN <value>          neighbour spring stiffness (default 0.65)\n"
+		  << "  -i <iterations>      solver iteration cap (default 1000000)\n"
+		  << "  -c                   build the mesh with traceShapes instead of buildShapes\n"
+		  << "  -a <arity>           mesh nodes inside every pixel side, 1 to 4 (default 3)\n"
+		  << "  -decimate            solve with straight boundary runs collapsed to their ends\n"
+		  << "  -densify             with -decimate, write the SVG with every node put back\n"
+		  << "  -multilevel          warm start the solver from ever coarser copies of the mesh\n"
+		  << "  -active              only move the vertices that have not settled yet\n"
+		  << "  -o <file>            write the JSON report to file instead of stdout\n"
+		  << "Without inputs, every PNG in assets/ is used.\n"
+		  << "\n"
+		  << "Synthetic scaling run, replaces the inputs:\n"
+		  << "  -s <sizes>           comma separated edge lengths, or 'all' for 64 to 4096\n"
+		  << "  -f <kinds>           comma separated flat, dither, noise (default flat)\n"
+		  << "  -p <colors>          palette size (default 8)\n"
+		  << "  -seed <n>            generator seed (default 1)\n"
+		  << "  -b <seconds>         skip sizes expected to take longer than this (default 60)\n"
+		  << "  -plot <file>         write median stage times against pixel count for bench/plot.gp\n";
+	std::exit(1);
+}
+
+static std::vector<std::string_view> split(std::string_view list)
+{
+	std::vector<std::string_view> items;
+	while (!list.empty()) {
+		const auto comma = list.find(',');
+		items.push_back(list.substr(0, comma));
+		list.remove_prefix(comma == list.npos ? list.size() : comma + 1);
+	}
+	return items;
+}
+
+static Options parseOptions(int argc, char **argv)
+{
+	Options opts;
+	for (int i = 1; i < argc; ++i) {
+		const std::string_view arg = argv[i];
+		auto value = [&] {
+			if (i + 1 >= argc)
+				usage(argv[0]);
+			return argv[++i];
+		};
+		if (arg == "-n") {
+			opts.runs = std::max(1l, std::atol(value()));
+		} else if (arg == "-d") {
+			opts.delta_c = std::atoi(value());
+		} else if (arg == "-k0") {
+			opts.k0 = std::atof(value());
+		} else if (arg == "-kN") {
+			opts.kN = std::atof(value());
+		} else if (arg == "-i") {
+			opts.max_iterations = std::atol(value());
+		} else if (arg == "-c") {
+			opts.trace_contours = true;
+		} else if (arg == "-decimate") {
+			opts.decimate = true;
+		} else if (arg == "-densify") {
+			opts.densify = true;
+		} else if (arg == "-multilevel") {
+			opts.multilevel = true;
+		} else if (arg == "-active") {
+			opts.active_set = true;
+		} else if (arg == "-a") {
+			opts.arity = std::clamp<long>(std::atol(value()), 1, max_arity);
+		} else if (arg == "-o") {
+			opts.output = value();
+		} else if (arg == "-s") {
+			const std::string_view list = value();
+			if (list == "all") {
+				for (size_t size = 64; size <= 4096; size *= 2)
+					opts.sizes.push_back(size);
+			} else {
+				for (const auto item : split(list))
+					opts.sizes.push_back(std::atol(std::string(item).c_str()));
+			}
+		} else if (arg == "-f") {
+			opts.fragmentations.clear();
+			for (const auto item : split(value())) {
+				Fragmentation f;
+				if (!parseFragmentation(item, f))
+					usage(argv[0]);
+				opts.fragmentations.push_back(f);
+			}
+		} else if (arg == "-p") {
+			opts.palette = std::max(1l, std::atol(value()));
+		} else if (arg == "-seed") {
+			opts.seed = std::strtoull(value(), nullptr, 10);
+		} else if (arg == "-b") {
+			opts.budget_s = std::atof(value());
+		} else if (arg == "-plot") {
+			opts.plot = value();
+		} else if (arg.starts_with("-")) {
+			usage(argv[0]);
+		} else {
+			opts.corpus.emplace_back(arg);
+		}
+	}
+	if (opts.corpus.empty()) {
+		opts.corpus.emplace_back("assets");
+	}
+
+	std::vector<fs::path> files;
+	for (const auto &path : opts.corpus) {
+		if (fs::is_directory(path)) {
+			for (const auto &entry : fs::directory_iterator(path)) {
+				if (entry.path().extension() == ".png")
+					files.push_back(entry.path());
+			}
+		} else {
+			files.push_back(path);
+		}
+	}
+	std::sort(files.begin(), files.end());
+	opts.corpus = std::move(files);
+	return opts;
+}
+
+struct Report
+{
+	std::string name;
+	size_t width;
+	size_t height;
+	Samples stages[7] = {
+		{ "clusters", {} },
+		{ "buildShapes", {} },
+		{ "decimateCollinear", {} },
+		{ "clusterBoundaries", {} },
+		{ "buildForceModel", {} },
+		{ "applyForces", {} },
+		{ "serializeSVG", {} },
+	};
+	size_t components = 0;
+	size_t nodes = 0;
+	size_t edges = 0;
+	size_t solver_nodes = 0;
+	size_t iterations = 0;
+	size_t coarse_iterations = 0;
+	size_t vertex_updates = 0;
+	bool converged = false;
+
+	double totalMedianMs() const
+	{
+		double total = 0.0;
+		for (const auto &stage : stages)
+			total += stage.median();
+		return total;
+	}
+
+	void write(std::ostream &os) const
+	{
+		os << "    {\n"
+		   << "      \"name\": \"" << name << "\",\n"
+		   << "      \"width\": " << width << ",\n"
+		   << "      \"height\": " << height << ",\n"
+		   << "      \"pixels\": " << width * height << ",\n"
+		   << "      \"clusters\": " << components << ",\n"
+		   << "      \"nodes\": " << nodes << ",\n"
+		   << "      \"edges\": " << edges << ",\n"
+		   << "      \"solver_nodes\": " << solver_nodes << ",\n"
+		   << "      \"solver_iterations\": " << iterations << ",\n"
+		   << "      \"coarse_iterations\": " << coarse_iterations << ",\n"
+		   << "      \"vertex_updates\": " << vertex_updates << ",\n"
+		   << "      \"converged\": " << (converged ? "true" : "false") << ",\n"
+		   << "      \"stages\": {\n";
+		for (size_t i = 0; i < std::size(stages); ++i) {
+			os << "        ";
+			stages[i].report(os);
+			os << (i + 1 < std::size(stages) ? ",\n" : "\n");
+		}
+		os << "      }\n"
+		   << "    }";
+	}
+};
+
+// Stage times come from the library's trace hook, so they follow whatever
+// depixel::depixelize runs.
+static Report runPipeline(std::string name, depixel::image_view image, Options const &opts)
+{
+	Report report{ std::move(name), image.width, image.height };
+
+	depixel::params p;
+	p.delta_c = opts.delta_c;
+	p.k0 = opts.k0;
+	p.kN = opts.kN;
+	p.max_iterations = opts.max_iterations;
+	p.trace_contours = opts.trace_contours;
+	p.arity = opts.arity;
+	p.decimate = opts.decimate;
+	p.densify = opts.densify;
+	p.multilevel = opts.multilevel;
+	p.active_set = opts.active_set;
+	p.on_stage = [&] (const char *stage, double ms) {
+		for (auto &samples : report.stages) {
+			if (std::strcmp(samples.name, stage) == 0)
+				samples.ms.push_back(ms);
+		}
+	};
+
+	for (size_t run = 0; run < opts.runs; ++run) {
+		const auto out = depixel::depixelize(image, p);
+		report.components = out.clusters;
+		report.nodes = out.mesh_nodes;
+		report.edges = out.mesh_edges;
+		report.solver_nodes = out.nodes;
+		report.iterations = out.iterations;
+		report.coarse_iterations = out.coarse_iterations;
+		report.vertex_updates = out.vertex_updates;
+		report.converged = out.converged;
+	}
+	return report;
+}
+
+static bool benchImage(std::ostream &os, fs::path const &path, Options const &opts)
+{
+	int width, height, channels;
+	auto pixels = stbi_load(path.c_str(), &width, &height, &channels, 0);
+	if (!pixels) {
+		std::cerr << "cannot load " << path << ": " << stbi_failure_reason() << "\n";
+		return false;
+	}
+	const depixel::image_view image{ pixels, size_t(width), size_t(height), 0, depixel::formatOf(channels) };
+	runPipeline(path.generic_string(), image, opts).write(os);
+	stbi_image_free(pixels);
+	return true;
+}
+
+// Runs every requested size of every fragmentation kind, smallest first. A
+// size is skipped once the previous one, scaled quadratically in the pixel
+// count, would overrun the time budget.
+static void benchSynthetic(std::ostream &os, Options const &opts)
+{
+	std::ofstream plot;
+	if (!opts.plot.empty()) {
+		plot.open(opts.plot);
+		plot << "# pixels";
+		for (const auto &stage : Report{}.stages)
+			plot << ' ' << stage.name;
+		plot << '\n';
+	}
+
+	bool first = true;
+	auto sizes = opts.sizes;
+	std::sort(sizes.begin(), sizes.end());
+	for (const auto fragmentation : opts.fragmentations) {
+		if (plot.is_open()) {
+			// gnuplot data blocks are separated by two blank lines
+			plot << (first ? "" : "\n\n") << "# " << fragmentationName(fragmentation) << '\n';
+		}
+		double last_ms = 0.0;
+		size_t last_pixels = 0;
+		for (const auto size : sizes) {
+			const double pixels = double(size * size);
+			if (last_pixels) {
+				const double growth = pixels / double(last_pixels);
+				if (last_ms * double(opts.runs) * growth * growth > opts.budget_s * 1000.0) {
+					std::cerr << "skipping " << fragmentationName(fragmentation) << " from " << size
+						  << ", over the time budget\n";
+					break;
+				}
+			}
+			SynthParams params{ size, opts.palette, fragmentation, opts.seed };
+			auto rgb = synthesize(params);
+			const auto name = std::string("synthetic/") + fragmentationName(fragmentation) + "/" + std::to_string(size);
+			std::cerr << "benchmarking " << name << "\n";
+			const auto report = runPipeline(name, { rgb.data(), size, size }, opts);
+
+			os << (first ? "" : ",\n");
+			report.write(os);
+			first = false;
+			if (plot.is_open()) {
+				plot << size * size;
+				for (const auto &stage : report.stages)
+					plot << ' ' << stage.median();
+				plot << '\n';
+			}
+			last_ms = report.totalMedianMs();
+			last_pixels = size * size;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const auto opts = parseOptions(argc, argv);
+
+	std::ofstream file;
+	if (!opts.output.empty()) {
+		file.open(opts.output);
+	}
+	std::ostream &os = opts.output.empty() ? std::cout : file;
+
+	os << "{\n"
+	   << "  \"runs\": " << opts.runs << ",\n"
+	   << "  \"delta_c\": " << opts.delta_c << ",\n"
+	   << "  \"k0\": " << opts.k0 << ",\n"
+	   << "  \"kN\": " << opts.kN << ",\n"
+	   << "  \"max_iterations\": " << opts.max_iterations << ",\n"
+	   << "  \"mesh_builder\": \"" << (opts.trace_contours ? "traceShapes" : "buildShapes") << "\",\n"
+	   << "  \"arity\": " << opts.arity << ",\n"
+	   << "  \"images\": [\n";
+	bool first = true;
+	int status = 0;
+	if (!opts.sizes.empty()) {
+		benchSynthetic(os, opts);
+	} else {
+		for (const auto &path : opts.corpus) {
+			std::cerr << "benchmarking " << path.generic_string() << "\n";
+			std::ostringstream entry;
+			if (!benchImage(entry, path, opts)) {
+				status = 1;
+				continue;
+			}
+			os << (first ? "" : ",\n") << entry.str();
+			first = false;
+		}
+	}
+	os << "\n  ],\n"
+	   << "  \"peak_rss_kb\": " << peakRssKb() << "\n"
+	   << "}\n";
+	return status;
+}
@@ -0,0 +1,64 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "depixel.hpp"
+
+// Behaviour the benchmark numbers do not show, run with make check.
+
+static int failures = 0;
+
+static void expect(bool ok, std::string const &what)
+{
+	if (!ok) {
+		std::cerr << "FAIL: " << what << '\n';
+		++failures;
+	}
+}
+
+// Two plus-shaped sprites on a solid magenta background: the crops hold the
+// background in their corners, which must not become shapes of their own.
+static void solidAtlas()
+{
+	const size_t width = 9, height = 5;
+	std::vector<unsigned char> pixels(width * height * 3);
+	for (size_t i = 0; i < width * height; ++i) {
+		pixels[i * 3 + 0] = 255;
+		pixels[i * 3 + 1] = 0;
+		pixels[i * 3 + 2] = 255;
+	}
+	auto paint = [&] (size_t x, size_t y, unsigned char r, unsigned char g, unsigned char b) {
+		pixels[(x + y * width) * 3 + 0] = r;
+		pixels[(x + y * width) * 3 + 1] = g;
+		pixels[(x + y * width) * 3 + 2] = b;
+	};
+	for (size_t x0 : { 1, 5 }) {
+		paint(x0 + 1, 1, 200, 0, 0);
+		paint(x0, 2, 200, 0, 0);
+		paint(x0 + 1, 2, 200, 0, 0);
+		paint(x0 + 2, 2, 200, 0, 0);
+		paint(x0 + 1, 3, 200, 0, 0);
+	}
+
+	depixel::image_view image{ pixels.data(), width, height };
+	depixel::params p;
+	p.delta_c = 0;
+	depixel::atlas_params a;
+	a.threads = 1;
+	const auto atlas = depixel::depixelizeAtlas(image, p, a);
+	expect(atlas.sprites.size() == 2, "solid atlas: two sprites");
+	for (const auto &sprite : atlas.sprites) {
+		expect(sprite.out.clusters == 1, "solid atlas: one cluster per sprite, got " + std::to_string(sprite.out.clusters));
+		expect(sprite.out.svg.find("ff00ff") == std::string::npos, "solid atlas: no background shape");
+	}
+}
+
+int main()
+{
+	solidAtlas();
+	if (failures) {
+		std::cerr << failures << " check(s) failed\n";
+		return 1;
+	}
+	std::cout << "all checks passed\n";
+	return 0;
+}
@@ -0,0 +1,22 @@
+# Plots median stage time against pixel count from a depixel_bench -plot file:
+#   gnuplot -e "data='scaling.dat'" bench/plot.gp
+# Every fragmentation kind is one data block and gets its own point type.
+if (!exists("data")) data = 'scaling.dat'
+if (!exists("out")) out = 'scaling.png'
+
+stages = "clusters buildShapes decimateCollinear clusterBoundaries buildForceModel applyForces serializeSVG"
+
+stats data using 1 nooutput
+blocks = STATS_blocks
+
+set terminal pngcairo size 1000,700
+set output out
+set logscale xy
+set xlabel 'pixels'
+set ylabel 'median wall time (ms)'
+set key outside right top
+set grid
+
+plot for [b=0:blocks-1] for [col=2:8] data index b using 1:col \
+	with linespoints linecolor col-1 pointtype b+5 \
+	title (b == 0 ? word(stages, col-1) : '')
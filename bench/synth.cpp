@@ -0,0 +1,134 @@
+#include "synth.hpp"
+#include <algorithm>
+#include <array>
+
+namespace {
+
+// splitmix64, so the output does not depend on the standard library's
+// distribution implementations
+struct Random
+{
+	uint64_t state;
+
+	uint64_t next()
+	{
+		uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	size_t below(size_t n)
+	{
+		return size_t(next() % n);
+	}
+};
+
+std::vector<Color> makePalette(size_t count, Random &rng)
+{
+	std::vector<Color> palette;
+	palette.reserve(count);
+	for (size_t i = 0; i < count; ++i) {
+		const auto bits = rng.next();
+		palette.emplace_back(byte(bits), byte(bits >> 8), byte(bits >> 16));
+	}
+	return palette;
+}
+
+void put(std::vector<byte> &rgb, size_t at, Color color)
+{
+	rgb[at * 3 + 0] = color.r;
+	rgb[at * 3 + 1] = color.g;
+	rgb[at * 3 + 2] = color.b;
+}
+
+void flat(std::vector<byte> &rgb, size_t size, std::vector<Color> const &palette, Random &rng)
+{
+	for (size_t at = 0; at < size * size; ++at) {
+		put(rgb, at, palette[0]);
+	}
+	const size_t rects = 4 * palette.size();
+	for (size_t r = 0; r < rects; ++r) {
+		const size_t w  = 1 + rng.below(std::max<size_t>(size / 3, 1));
+		const size_t h  = 1 + rng.below(std::max<size_t>(size / 3, 1));
+		const size_t x0 = rng.below(size);
+		const size_t y0 = rng.below(size);
+		const auto color = palette[rng.below(palette.size())];
+		for (size_t y = y0; y < std::min(y0 + h, size); ++y) {
+			for (size_t x = x0; x < std::min(x0 + w, size); ++x) {
+				put(rgb, x + y * size, color);
+			}
+		}
+	}
+}
+
+void dither(std::vector<byte> &rgb, size_t size, std::vector<Color> const &palette, Random &rng)
+{
+	static const std::array<std::array<unsigned, 4>, 4> bayer = {{
+		{  0,  8,  2, 10 },
+		{ 12,  4, 14,  6 },
+		{  3, 11,  1,  9 },
+		{ 15,  7, 13,  5 },
+	}};
+	// a diagonal ramp through the palette, phase shifted per image
+	const size_t phase = rng.below(2 * size);
+	const size_t span  = std::max<size_t>(2 * size / palette.size(), 1);
+	for (size_t y = 0; y < size; ++y) {
+		for (size_t x = 0; x < size; ++x) {
+			const size_t ramp  = (x + y + phase) % (2 * size);
+			const size_t level = ramp / span;
+			const size_t frac  = 16 * (ramp % span) / span;
+			const size_t index = frac > bayer[y % 4][x % 4] ? level + 1 : level;
+			put(rgb, x + y * size, palette[index % palette.size()]);
+		}
+	}
+}
+
+void noise(std::vector<byte> &rgb, size_t size, std::vector<Color> const &palette, Random &rng)
+{
+	for (size_t at = 0; at < size * size; ++at) {
+		put(rgb, at, palette[rng.below(palette.size())]);
+	}
+}
+
+}
+
+std::vector<byte> synthesize(SynthParams const &params)
+{
+	Random rng{ params.seed };
+	const auto palette = makePalette(std::max<size_t>(params.palette, 1), rng);
+	std::vector<byte> rgb(params.size * params.size * 3);
+	switch (params.fragmentation) {
+	case Fragmentation::Flat:
+		flat(rgb, params.size, palette, rng);
+		break;
+	case Fragmentation::Dither:
+		dither(rgb, params.size, palette, rng);
+		break;
+	case Fragmentation::Noise:
+		noise(rgb, params.size, palette, rng);
+		break;
+	}
+	return rgb;
+}
+
+bool parseFragmentation(std::string_view name, Fragmentation &out)
+{
+	for (auto f : { Fragmentation::Flat, Fragmentation::Dither, Fragmentation::Noise }) {
+		if (name == fragmentationName(f)) {
+			out = f;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *fragmentationName(Fragmentation fragmentation)
+{
+	switch (fragmentation) {
+	case Fragmentation::Flat:   return "flat";
+	case Fragmentation::Dither: return "dither";
+	case Fragmentation::Noise:  return "noise";
+	}
+	return "?";
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include "data.hpp"
+
+// How finely the generated art breaks up into clusters.
+enum class Fragmentation {
+	Flat,   // a few large rectangles of flat colour
+	Dither, // ordered dithering between palette neighbours, mostly checkerboards
+	Noise,  // every pixel drawn independently from the palette
+};
+
+struct SynthParams {
+	size_t size = 64;
+	size_t palette = 8;
+	Fragmentation fragmentation = Fragmentation::Flat;
+	uint64_t seed = 1;
+};
+
+// Deterministic RGB pixel art of size x size pixels. The same parameters
+// always produce the same image, on every platform.
+std::vector<byte> synthesize(SynthParams const &params);
+
+bool parseFragmentation(std::string_view name, Fragmentation &out);
+const char *fragmentationName(Fragmentation fragmentation);
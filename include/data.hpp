@@ -3,6 +3,10 @@
 #include <map>
 #include <array>
 #include <cstddef>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include "image_view.hpp"
 
 using byte = unsigned char;
 using id_t = unsigned;
@@ -21,10 +25,7 @@ struct Vertex
 {
 	id_t id;
 
-	Color color(byte *data) const
-	{
-		return Color(data[id * 3 + 0], data[id * 3 + 1], data[id * 3 + 2]);
-	}
+	Color color(depixel::image_view const &image) const;
 };
 
 struct union_find
@@ -80,7 +81,7 @@ struct vec2
 	D y;
 
 	vec2() = default;
-	vec2(D x, D y) : x(x), y(y) {}
+	constexpr vec2(D x, D y) : x(x), y(y) {}
 	D &operator[](size_t i) { return (&x)[i]; }
 	const D &operator[](size_t i) const { return (&x)[i]; }
 	D length() const {
@@ -112,6 +113,103 @@ inline vec2<D> operator/(vec2<D> lhs, D div)
 	return vec2{ lhs.x / div, lhs.y / div };
 }
 
+// The image as indices into its distinct colours, so that clustering compares
+// bytes and looks colour pairs up in a table. Fully transparent pixels share
+// one entry. Only the one-shot Clusters constructor builds it; ClusterSweep
+// keeps the colour distances themselves for repeated builds.
+struct Palette
+{
+	size_t width = 0;
+	std::vector<byte> index;
+	std::vector<Color> colors;
+	std::vector<bool> opaque;
+
+	// same[a * colors.size() + b] is set when entries a and b are opaque and within delta_c
+	std::vector<byte> sameColor(int delta_c) const;
+};
+
+// empty when the image has more than 256 colours
+std::optional<Palette> quantise(depixel::image_view const &image);
+
+// Cluster of every pixel as a compact index, in the order of Clusters::get(),
+// padded with a one pixel border so neighbours are read without bounds checks.
+struct LabelImage
+{
+	// the border, and transparent pixels
+	static constexpr id_t outside = id_t(-1);
+
+	size_t width;
+	size_t height;
+	// (width + 2) * (height + 2) labels
+	std::vector<id_t> label;
+	// Clusters id of every compact index
+	std::vector<id_t> cluster;
+
+	size_t stride() const { return width + 2; }
+
+	// x and y may be one past either edge, size_t(-1) included
+	id_t at(size_t x, size_t y) const
+	{
+		return label[(y + 1) * stride() + (x + 1)];
+	}
+};
+
+// Every neighbour pair of an image with its squared colour distance, sorted
+// once, so clusters for any delta_c follow without reading the pixels again.
+// The axis-aligned unions of a threshold are a prefix of the sorted pairs and
+// are kept between calls: raising delta_c only applies the new ones, like a
+// Kruskal sweep. Diagonals depend on both pairs of their 2x2 block and are
+// resolved again on top each time.
+class ClusterSweep
+{
+public:
+	size_t width;
+	size_t height;
+	// first fully transparent pixel
+	id_t background = id_t(-1);
+
+	explicit ClusterSweep(depixel::image_view const &image);
+
+	// clusters at delta_c up to the diagonal conflicts, which are returned in
+	// raster order for Clusters to resolve
+	union_find merge(int delta_c, std::vector<std::pair<size_t, size_t>> &conflicts);
+	// number of clusters at every delta_c from 0 to max_delta_c, in one pass
+	// where every 2x2 block keeps the diagonal that joined first; Clusters
+	// settles a block again once both are within delta_c, so a count can be
+	// off by the few blocks that would then switch diagonals
+	std::vector<size_t> components(int max_delta_c);
+
+private:
+	struct Pair {
+		uint32_t distance;
+		id_t a;
+		id_t b;
+	};
+	// 2x2 block: main diagonal from tl down to the right, counter diagonal from tl+1 down to the left
+	struct Block {
+		uint32_t main;
+		uint32_t counter;
+		id_t tl;
+	};
+
+	std::vector<Pair> axis;
+	// by the nearer of their diagonals
+	std::vector<Block> blocks;
+	size_t opaque = 0;
+	// the transparent pixels joined into the background, nothing else
+	union_find initial;
+	// axis-aligned unions of every pair up to swept_limit
+	union_find swept;
+	size_t swept_end = 0;
+	size_t swept_joined = 0;
+	uint32_t swept_limit = 0;
+
+	template <typename Pixels>
+	void collect(Pixels const &pixels);
+	void sweep(uint32_t limit);
+	union_find merge(int delta_c, std::vector<std::pair<size_t, size_t>> &conflicts, size_t &joined);
+};
+
 struct Clusters
 {
 	using cluster = std::vector<Vertex>;
@@ -122,19 +220,29 @@ private:
 	std::map<id_t, cluster> cluster2vertex;
 	std::map<id_t, Color> avg;
 	union_find vertex2cluster;
+	// root of the fully transparent pixels, which repr() reports as outside
+	id_t background = id_t(-1);
 
 public:
-	Clusters(size_t width, size_t height, byte *data, int delta_c);
+	// through quantise() when the image has at most 256 colours
+	Clusters(depixel::image_view const &image, int delta_c);
+	// same clusters as building them from the pixels, cheaper when delta_c only grows
+	Clusters(depixel::image_view const &image, ClusterSweep &sweep, int delta_c);
 	id_t repr(size_t id);
 	std::map<id_t, cluster> const &get() const;
 	size_t components() const ;
-	Color average_color(byte *data, id_t clust);
+	LabelImage labels() const;
+	Color average_color(depixel::image_view const &image, id_t clust);
+	Color average_color(Palette const &palette, id_t clust);
 	Color average_color(id_t clust) const;
 
 private:
 	using conflict = std::pair<size_t, size_t>;
-	std::vector<conflict> merge_nonconflicts(byte *data, int delta_c);
+	template <typename Pixels>
+	std::vector<conflict> merge_nonconflicts(Pixels const &pixels);
 	void reverse_mapping();
+	template <typename ColorOf>
+	Color average_color(id_t clust, ColorOf &&color_of);
 	void conflict_resolution(std::vector<conflict> const& diagonals);
 };
 
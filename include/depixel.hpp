@@ -0,0 +1,94 @@
+#pragma once
+// Public interface of libdepixel: pixel art in, SVG out, no windowing or GL
+// involved. The individual stages stay available through mesh.hpp and
+// pipeline.hpp for callers that need the intermediate results.
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+#include "image_view.hpp"
+
+namespace depixel {
+
+struct params {
+	// largest RGB distance between neighbouring pixels of one cluster
+	int delta_c = 48;
+	// local and neighbour spring stiffness of the smoothing simulation
+	float k0 = 0.3f;
+	float kN = 0.65f;
+	// cap on solver sweeps, 0 runs until the forces settle
+	size_t max_iterations = 0;
+	// build the mesh with traceShapes, walking the cluster outlines ring by ring
+	bool trace_contours = false;
+	// mesh nodes inside every pixel side, 1 to 4: fewer solve faster, more
+	// follow the outlines more smoothly
+	size_t arity = 3;
+	// solve on the mesh with its straight boundary runs collapsed to their ends
+	bool decimate = false;
+	// with decimate, put the removed nodes back on the solved outlines in the SVG
+	bool densify = false;
+	// solve ever coarser copies of the mesh first, each warm starting the next
+	bool multilevel = false;
+	// freeze settled vertices, so late sweeps only move the ones still settling
+	bool active_set = false;
+	// trace hook, called on the converting thread after every stage with its
+	// name and wall time in milliseconds
+	std::function<void(const char *stage, double ms)> on_stage;
+};
+
+struct result {
+	std::string svg;
+	size_t clusters = 0;
+	// nodes and edges of the mesh as built, nodes is what the solver moved
+	size_t mesh_nodes = 0;
+	size_t mesh_edges = 0;
+	size_t nodes = 0;
+	size_t iterations = 0;
+	// sweeps over the coarse levels of a multilevel solve, before the iterations
+	size_t coarse_iterations = 0;
+	// vertex moves over all sweeps, see Solver::updates
+	size_t vertex_updates = 0;
+	bool converged = false;
+};
+
+result depixelize(image_view image, params const &p = {});
+
+struct atlas_params {
+	// fixed cell size; 0 finds the sprites as connected regions of
+	// non-background pixels instead
+	size_t grid_width = 0;
+	size_t grid_height = 0;
+	// worker threads, 0 for one per core
+	unsigned threads = 0;
+};
+
+// placement of one sprite within the atlas, in pixels
+struct sprite_box {
+	size_t x = 0;
+	size_t y = 0;
+	size_t width = 0;
+	size_t height = 0;
+};
+
+struct sprite {
+	sprite_box box;
+	// out.svg is a standalone document of this sprite alone
+	result out;
+};
+
+struct atlas_result {
+	std::vector<sprite> sprites;
+	// the whole atlas, one <g> per sprite at its place in the atlas
+	std::string svg;
+};
+
+// The top left pixel decides the background: the fully transparent pixels
+// when it is transparent, otherwise every pixel of exactly its colour.
+// Sprites are returned row by row.
+std::vector<sprite_box> findSprites(image_view image, atlas_params const &a = {});
+
+// depixelizes every sprite of the atlas on its own, spread over threads; the
+// background findSprites sees is left out of the sprites like transparency
+atlas_result depixelizeAtlas(image_view image, params const &p = {}, atlas_params const &a = {});
+
+}
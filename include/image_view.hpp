@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+#include <cassert>
+
+namespace depixel {
+
+enum class pixel_format : unsigned char {
+	gray,
+	gray_alpha,
+	rgb,
+	rgba,
+	// one byte per pixel indexing image_view::palette
+	indexed,
+};
+
+// Borrowed 8-bit pixels, never copied or converted by the library. Rows may be
+// padded or belong to a larger image, so sprites can be cut out of an atlas
+// with crop().
+struct image_view {
+	const unsigned char *pixels = nullptr;
+	size_t width = 0;
+	size_t height = 0;
+	// bytes from the start of one row to the next, 0 for tightly packed rows
+	size_t stride = 0;
+	pixel_format format = pixel_format::rgb;
+	// RGBA entries, only read for pixel_format::indexed
+	const unsigned char *palette = nullptr;
+	// pixels with exactly these bytes read as fully transparent, like a colour key
+	const unsigned char *key = nullptr;
+
+	size_t channels() const
+	{
+		switch (format) {
+		case pixel_format::gray:       return 1;
+		case pixel_format::gray_alpha: return 2;
+		case pixel_format::rgb:        return 3;
+		case pixel_format::rgba:       return 4;
+		case pixel_format::indexed:    return 1;
+		}
+		return 0;
+	}
+
+	size_t row_stride() const
+	{
+		return stride ? stride : width * channels();
+	}
+
+	const unsigned char *pixel(size_t x, size_t y) const
+	{
+		return pixels + y * row_stride() + x * channels();
+	}
+
+	image_view crop(size_t x, size_t y, size_t w, size_t h) const
+	{
+		assert(x + w <= width && y + h <= height);
+		image_view sub = *this;
+		sub.pixels = pixel(x, y);
+		sub.width = w;
+		sub.height = h;
+		sub.stride = row_stride();
+		return sub;
+	}
+};
+
+// pixel format of a stb_image style channel count
+inline pixel_format formatOf(int channels)
+{
+	switch (channels) {
+	case 1:  return pixel_format::gray;
+	case 2:  return pixel_format::gray_alpha;
+	case 4:  return pixel_format::rgba;
+	default: return pixel_format::rgb;
+	}
+}
+
+}
@@ -0,0 +1,308 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <array>
+#include <span>
+#include <cassert>
+#include <cstdint>
+#include "data.hpp"
+#include "preview.hpp"
+
+// Compact indices of the clusters a mesh node borders, in increasing order.
+// A node sits on a pixel side or corner, so it never touches more than four.
+struct ClusterSet {
+	std::array<id_t, 4> ids;
+	uint8_t count = 0;
+
+	ClusterSet() = default;
+	explicit ClusterSet(id_t c) : ids{ c }, count(1) {}
+
+	void insert(id_t c)
+	{
+		size_t at = 0;
+		while (at < count && ids[at] < c)
+			++at;
+		if (at < count && ids[at] == c)
+			return;
+		assert(count < ids.size());
+		for (size_t i = count; i > at; --i)
+			ids[i] = ids[i-1];
+		ids[at] = c;
+		++count;
+	}
+
+	ClusterSet &operator|=(ClusterSet const &other)
+	{
+		for (const auto c : other)
+			insert(c);
+		return *this;
+	}
+
+	ClusterSet operator&(ClusterSet const &other) const
+	{
+		ClusterSet common;
+		for (const auto c : *this) {
+			if (other.contains(c))
+				common.ids[common.count++] = c;
+		}
+		return common;
+	}
+
+	bool contains(id_t c) const
+	{
+		for (const auto id : *this) {
+			if (id == c)
+				return true;
+		}
+		return false;
+	}
+
+	const id_t *begin() const { return ids.data(); }
+	const id_t *end() const { return ids.data() + count; }
+};
+
+// Boundary mesh with 32-bit node ids. Every edge is stored once, with the
+// pair of clusters it separates; the adjacency is a CSR list of half-edges
+// pointing back to their edge.
+//
+// It is also a DCEL: every half-edge bounds one face, a ring around a cluster
+// walked the way the pixel sides are, so that outer rings have a negative
+// shoelace area and holes a positive one. A cluster has one outer ring and a
+// ring per hole, so polygons, holes and their nesting are read off the faces.
+struct Mesh {
+	using node_t = uint32_t;
+	using edge_t = uint32_t;
+
+	struct HalfEdge {
+		node_t to;
+		edge_t edge;
+	};
+
+	// compact cluster indices, id_t(-1) outside all shapes; clust1 is the face
+	// of the half-edge from the lower to the higher node
+	struct ClusterPair {
+		id_t clust1;
+		id_t clust2;
+	};
+
+	std::vector<vec2<float>> vert;
+	std::vector<ClusterSet> node_cluster_ids;
+	// half-edges leaving u are half_edge[edge_start[u]..edge_start[u+1])
+	std::vector<uint32_t> edge_start;
+	std::vector<HalfEdge> half_edge;
+	// index into pairs of every edge
+	std::vector<uint32_t> edge_pair;
+	std::vector<ClusterPair> pairs;
+
+	// the half-edge after h around its face, and that face
+	std::vector<uint32_t> next;
+	std::vector<uint32_t> face;
+	// nodes around face f, in the order of its half-edges, are
+	// face_node[face_start[f]..face_start[f+1])
+	std::vector<uint32_t> face_start;
+	std::vector<node_t> face_node;
+	// compact cluster index (as in node_cluster_ids) of every face, id_t(-1) outside all shapes
+	std::vector<id_t> face_cluster;
+	// Clusters id of every compact cluster index
+	std::vector<id_t> cluster_id;
+	// pixel lattice segments every edge stands for, empty when each is one
+	std::vector<uint32_t> edge_span;
+
+	size_t edges() const { return edge_pair.size(); }
+	size_t faces() const { return face_cluster.size(); }
+
+	std::span<const node_t> ring(size_t f) const
+	{
+		return { face_node.data() + face_start[f], face_node.data() + face_start[f+1] };
+	}
+
+	std::span<const HalfEdge> neighbours(node_t u) const
+	{
+		return { half_edge.data() + edge_start[u], half_edge.data() + edge_start[u+1] };
+	}
+
+	ClusterPair separates(HalfEdge const &e) const
+	{
+		return pairs[edge_pair[e.edge]];
+	}
+};
+
+// Nodes inside every pixel side, from 1 to max_arity. Fewer mesh and solve
+// faster, more let the outlines bend more smoothly.
+inline constexpr size_t default_arity = 3;
+inline constexpr size_t max_arity = 4;
+
+Mesh buildShapes(Clusters& clusters, size_t width, size_t height, Preview *preview = nullptr, size_t arity = default_arity);
+// The same mesh, up to node and edge order, traced ring by ring along the
+// cluster boundaries in one pass instead of assembled side by side.
+Mesh traceShapes(Clusters& clusters, size_t width, size_t height, Preview *preview = nullptr, size_t arity = default_arity);
+
+// A mesh with the inner nodes of its straight boundary runs removed. The
+// nodes within margin pixels of either end of a run are kept, since the
+// outline bends there; the rest of the run is left as one edge.
+struct Decimation {
+	// node of the full mesh at fraction t of the way from coarse node a to b
+	struct Interpolant {
+		Mesh::node_t a;
+		Mesh::node_t b;
+		float t;
+	};
+
+	Mesh mesh;
+	std::vector<Interpolant> full;
+
+	// positions of every node of the full mesh from those of the coarse one
+	std::vector<vec2<float>> densify(std::span<const vec2<float>> pos) const;
+	// the same, moving the removed nodes from their rest positions as the
+	// nodes around them moved, so that bends between them survive
+	std::vector<vec2<float>> prolong(std::span<const vec2<float>> pos, std::span<const vec2<float>> rest) const;
+};
+
+Decimation decimateCollinear(Mesh const &mesh, float margin = 2.0f);
+
+// Ever coarser meshes for the multilevel solve, each dropping every other
+// node along the chains of the one before; levels[0] coarsens mesh. It stops
+// at min_nodes or once junctions leave too little to drop.
+std::vector<Decimation> coarsenLevels(Mesh const &mesh, size_t min_nodes = 64);
+
+struct Boundary {
+	using Polygon = std::vector<Mesh::node_t>;
+	std::map<size_t, Polygon> polys;
+	std::set<id_t> adj;
+};
+using BoundaryGraph = std::map<id_t, Boundary>;
+
+BoundaryGraph clusterBoundaries(Mesh const &mesh, Preview *preview = nullptr);
+
+// Ring of a cluster as indices into the vertex positions, so its area follows
+// the solver as the vertices move.
+struct Polygon {
+	std::vector<Mesh::node_t> nodes;
+	// at the rest positions
+	float signed_area;
+	int containment_level = 0;
+};
+
+using ClusterGraph = std::unordered_map<id_t, std::vector<Polygon>>;
+
+// polygons of every cluster from the faces of the mesh, holes at containment level 1
+ClusterGraph clusterGraph(Mesh const &mesh);
+
+std::pair<std::unordered_map<id_t, float>, std::unordered_map<id_t, vec2<float>>> calculateClusterAreas(
+	const std::unordered_map<size_t, std::vector<size_t>>& cluster_nodes,
+	const std::vector<vec2<float>>& vert,
+	ClusterGraph const& cluster_graph);
+
+// Everything the spring simulation derives from the mesh topology alone. It
+// does not depend on k0 or kN, so it is built once per mesh and reused.
+struct ForceModel {
+	std::vector<vec2<float>> vert0;
+	// CSR adjacency: neighbours of u are adj[adj_start[u]..adj_start[u+1])
+	std::vector<uint32_t> adj_start;
+	std::vector<Mesh::node_t> adj;
+	// stiffness of every spring relative to kN, lower across decimated runs
+	std::vector<float> adj_weight;
+	std::vector<std::vector<id_t>> vertex_clusters;
+	std::unordered_map<size_t, std::vector<size_t>> cluster_nodes;
+	ClusterGraph cluster_graph;
+	std::unordered_map<id_t, float> areas0;
+
+	// A vertex of a cluster ring, with the ring nodes before and after it,
+	// which are all the moving vertex needs to update the ring's area.
+	struct RingCorner {
+		id_t cluster;
+		Mesh::node_t prev;
+		Mesh::node_t next;
+	};
+	// ring corners at u are ring_corner[ring_start[u]..ring_start[u+1])
+	std::vector<uint32_t> ring_start;
+	std::vector<RingCorner> ring_corner;
+};
+
+ForceModel buildForceModel(Mesh const &mesh);
+
+inline constexpr float force_threshold = 0.001f;
+
+// State of one run of the spring simulation over a ForceModel.
+//
+// With an active set a vertex whose force stayed under the threshold for
+// settle_sweeps sweeps in a row is frozen, until a neighbour has moved by
+// more than wake_distance since it last woke its neighbours, or the area
+// ratio of one of its clusters has changed by wake_ratio or its centre by
+// wake_distance since the cluster last woke its vertices. Cluster areas
+// and centres are kept up to date as vertices move, so a sweep only
+// touches the vertices still active. Once those are all under the
+// threshold, every force is evaluated to confirm the run has settled.
+struct Solver {
+	static constexpr uint8_t settle_sweeps = 4;
+	static constexpr float wake_distance = 1e-4f;
+	static constexpr float wake_ratio = 1e-4f;
+
+	ForceModel const &model;
+	std::vector<vec2<float>> vert;
+	// vertex moves over all sweeps
+	size_t updates = 0;
+
+	explicit Solver(ForceModel const &model, bool active_set = false)
+		: model(model), vert(model.vert0), active_set(active_set)
+	{
+	}
+
+	// moves every active vertex once along its force, returns the largest force applied
+	float step(float k0, float kN);
+
+	bool uses_active_set() const { return active_set; }
+
+private:
+	bool active_set;
+	std::vector<Mesh::node_t> active;
+	std::vector<Mesh::node_t> still_active;
+	std::vector<uint8_t> queued;
+	// sweeps in a row under the threshold
+	std::vector<uint8_t> calm;
+	// distance moved since the vertex last woke its neighbours
+	std::vector<float> drift;
+	// net area, at rest and now, and sum of the vertex positions of every cluster
+	std::vector<float> area0;
+	std::vector<double> area;
+	std::vector<vec2<double>> center_sum;
+	std::vector<double> center_count;
+	// area ratio and centre of every cluster when it last woke its vertices
+	std::vector<float> ratio_seen;
+	std::vector<vec2<float>> center_seen;
+	// clusters with a vertex moved in this sweep
+	std::vector<uint8_t> dirty;
+	std::vector<id_t> changed;
+
+	float ratio(size_t c) const { return float(area[c]) / area0[c]; }
+	vec2<float> center(size_t c) const
+	{
+		return { float(center_sum[c].x / center_count[c]), float(center_sum[c].y / center_count[c]) };
+	}
+
+	void startActive();
+	void recount();
+	vec2<float> activeForce(Mesh::node_t u, float k0, float kN) const;
+	float confirmSettled(float k0, float kN);
+	float stepActive(float k0, float kN);
+};
+
+// Solves the levels of coarsenLevels(mesh) coarsest first, each from the
+// positions prolonged from the one above, and starts solver, which runs on
+// mesh, from the last of them. A level gets coarse_sweeps_per_node sweeps
+// per node at most, with the solver's active set setting. Returns the
+// sweeps spent on the coarse levels.
+inline constexpr size_t coarse_sweeps_per_node = 4;
+size_t warmStart(Solver &solver, Mesh const &mesh, std::span<const Decimation> levels, float k0, float kN);
+
+std::vector<vec2<float>> applyForces(ForceModel const &model, float k0, float kN);
+
+// one <g> per cluster, outermost first, without the enclosing document
+std::string serializeShapes(Clusters const &clusters, BoundaryGraph const &bnd, std::vector<vec2<float>> const &pos);
+std::string serializeSVG(std::string_view shapes);
+std::string serializeSVG(Clusters const &clusters, BoundaryGraph const &bnd, std::vector<vec2<float>> const &pos);
@@ -0,0 +1,138 @@
+#pragma once
+#include <vector>
+#include <optional>
+#include <atomic>
+#include <thread>
+#include <array>
+#include <span>
+#include <utility>
+#include "data.hpp"
+#include "mesh.hpp"
+#include "preview.hpp"
+
+// Memoises every stage of the conversion. Changing a parameter only drops
+// the stages downstream of it; the rest are served from the cache.
+class Pipeline
+{
+public:
+	enum stage : size_t {
+		Clustering,
+		Meshing,
+		Boundaries,
+		Modelling,
+		Smoothing,
+	};
+
+private:
+	depixel::image_view image;
+	// sorted neighbour distances, every delta_c reuses them
+	ClusterSweep sweep;
+	std::optional<std::vector<size_t>> cached_components;
+	Preview *preview;
+
+	int delta_c;
+	float k0;
+	float kN;
+
+	std::optional<Clusters> cached_clusters;
+	std::optional<Mesh> cached_mesh;
+	std::optional<BoundaryGraph> cached_boundaries;
+	std::optional<ForceModel> cached_model;
+	std::optional<std::vector<vec2<float>>> cached_smoothed;
+
+public:
+	Pipeline(depixel::image_view image, Preview *preview, int delta_c, float k0, float kN)
+		: image(image), sweep(image), preview(preview),
+		  delta_c(delta_c), k0(k0), kN(kN)
+	{
+	}
+
+	void invalidate(stage from);
+	bool cached(stage s) const;
+
+	void setClusterThreshold(int value);
+	void setSprings(float local, float neighbour);
+
+	Clusters &clusters();
+	// number of clusters at every delta_c from 0 to 256
+	std::vector<size_t> const &components();
+	Mesh &mesh();
+	BoundaryGraph &boundaries();
+	ForceModel &model();
+	std::vector<vec2<float>> &smoothed();
+	// caches vert unless it settled with other springs than the current ones
+	bool setSmoothed(std::vector<vec2<float>> vert, float local, float neighbour);
+};
+
+// Runs the spring simulation on a worker thread. Positions reach the GUI
+// through a lock-free double buffer: the worker only fills the back buffer
+// while no frame is pending and the GUI only reads the front buffer while one
+// is, so neither side ever waits for the other.
+class Simulation
+{
+	enum : unsigned {
+		FrontIndex   = 1u << 0,
+		FramePending = 1u << 1,
+	};
+
+	ForceModel model;
+	Solver solver;
+	std::array<std::vector<vec2<float>>, 2> frames;
+	std::atomic<unsigned> frame_state{0};
+
+	std::atomic<float> k0;
+	std::atomic<float> kN;
+	std::atomic<bool> paused{false};
+	std::atomic<bool> cancelled{false};
+	std::atomic<bool> finished{false};
+	std::atomic<size_t> iterations{0};
+	std::atomic<float> initial_force{0.0f};
+	std::atomic<float> max_force{0.0f};
+	// springs of the sweep that settled, written before finished
+	float settled_k0 = 0.0f;
+	float settled_kN = 0.0f;
+	std::thread worker;
+
+	void publish();
+	void run();
+
+public:
+	Simulation(ForceModel const &model, float k0, float kN);
+	~Simulation();
+
+	void setSprings(float local, float neighbour);
+	void pause();
+	void resume();
+	void cancel();
+
+	bool isPaused() const { return paused.load(); }
+	bool isFinished() const { return finished.load(std::memory_order_acquire) && !cancelled.load(); }
+	size_t iteration() const { return iterations.load(std::memory_order_relaxed); }
+	float force() const { return max_force.load(std::memory_order_relaxed); }
+
+	// fraction of the way from the first sweep's force down to the threshold, on a log scale
+	float progress() const;
+
+	// hands the latest published frame to `show`, if there is one the GUI has not seen
+	template <typename F>
+	bool consume(F &&show)
+	{
+		const auto state = frame_state.load(std::memory_order_acquire);
+		if (!(state & FramePending))
+			return false;
+		show(std::span<const vec2<float>>(frames[state & FrontIndex]));
+		frame_state.store(state & FrontIndex, std::memory_order_release);
+		return true;
+	}
+
+	// final positions, only valid once isFinished()
+	std::vector<vec2<float>> const &result() const
+	{
+		return solver.vert;
+	}
+	// springs the final positions settled with, only valid once isFinished()
+	std::pair<float, float> springs() const
+	{
+		return { settled_k0, settled_kN };
+	}
+};
@@ -0,0 +1,20 @@
+#pragma once
+#include <span>
+#include "data.hpp"
+
+// Front end hook for watching the mesh stages at work. The stages take a
+// nullable Preview and skip all drawing work when there is none.
+struct Preview
+{
+	virtual ~Preview() = default;
+
+	// starts a new frame from the kept lines, false once the viewer is gone
+	virtual bool clear() = 0;
+	virtual void submit(std::span<const vec4<float>> lines, vec4<float> color) = 0;
+	virtual void draw() = 0;
+	// lines submitted so far survive clear()
+	virtual void keep() = 0;
+	virtual void removeAll() = 0;
+	// true once per request of the viewer to move on
+	virtual bool advance() = 0;
+};
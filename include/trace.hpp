@@ -0,0 +1,64 @@
+#pragma once
+// Scoped wall-clock tracing of the pipeline stages. Built with
+// -DDEPIXEL_TRACE (make TRACE=1) every scope lands in a per-thread ring
+// buffer and the buffers are written as a Chrome/Perfetto JSON trace on exit,
+// to $DEPIXEL_TRACE_FILE or trace.json. Without it the macros expand to
+// nothing.
+
+#ifdef DEPIXEL_TRACE
+#include <chrono>
+#include <cstdint>
+
+namespace trace {
+
+inline uint64_t now()
+{
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void record(const char *name, uint64_t start, uint64_t end);
+
+// writes every buffered event, called automatically on exit
+void dump(const char *path);
+
+class Scope
+{
+	const char *name;
+	uint64_t start;
+
+public:
+	explicit Scope(const char *name) : name(name), start(now()) {}
+	Scope(Scope const &) = delete;
+	Scope &operator=(Scope const &) = delete;
+
+	~Scope()
+	{
+		record(name, start, now());
+	}
+
+	// closes the current phase and opens the next one
+	void next(const char *next_name)
+	{
+		const auto at = now();
+		record(name, start, at);
+		name = next_name;
+		start = at;
+	}
+};
+
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) ::trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_PHASE(var, name) ::trace::Scope var(name)
+#define TRACE_NEXT(var, name) var.next(name)
+
+#else
+
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_PHASE(var, name) ((void)0)
+#define TRACE_NEXT(var, name) ((void)0)
+
+#endif
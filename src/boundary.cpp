@@ -0,0 +1,47 @@
+#include "mesh.hpp"
+#include "trace.hpp"
+#include <cassert>
+#include <vector>
+#include <map>
+#include <set>
+
+BoundaryGraph clusterBoundaries(Mesh const &mesh, Preview *preview)
+{
+	TRACE_SCOPE("clusterBoundaries");
+	vec4<float> color{ 1.0f, 0.0f, 1.0f, 1.0f };
+	std::vector<vec4<float>> lines;
+	if (preview) {
+		preview->removeAll();
+	}
+
+	// every face of the mesh is one ring of its cluster, nothing to trace
+	BoundaryGraph bnd;
+	// keyed by Clusters ids, the mesh only has compact indices
+	const auto cluster_of = [&] (id_t compact) {
+		return compact == id_t(-1) ? id_t(-1) : mesh.cluster_id[compact];
+	};
+	for (size_t f = 0; f < mesh.faces(); ++f) {
+		const auto cluster = cluster_of(mesh.face_cluster[f]);
+		const auto ring = mesh.ring(f);
+		bnd[cluster].polys[f] = Boundary::Polygon(ring.begin(), ring.end());
+
+		if (preview && preview->clear()) {
+			const auto &pos = mesh.vert;
+			for (size_t i = 0; i < ring.size(); ++i) {
+				const auto s = ring[i];
+				const auto t = ring[(i + 1) % ring.size()];
+				lines.emplace_back(pos[s].x, pos[s].y, pos[t].x, pos[t].y);
+			}
+			preview->submit(lines, color);
+			preview->draw();
+		}
+	}
+	for (const auto pair : mesh.edge_pair) {
+		const auto c1 = cluster_of(mesh.pairs[pair].clust1);
+		const auto c2 = cluster_of(mesh.pairs[pair].clust2);
+		bnd[c1].adj.emplace(c2);
+		bnd[c2].adj.emplace(c1);
+	}
+
+	return bnd;
+}
@@ -1,18 +1,257 @@
 #include "data.hpp"
+#include "trace.hpp"
 #include <cassert>
 #include <vector>
 #include <iostream>
+#include <optional>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 
-Clusters::Clusters(size_t width, size_t height, byte *data, int delta_c)
-	: width(width), height(height), vertex2cluster(width * height)
+// RGB colour of the pixel at p. Resolved at compile time so the clustering
+// loop does not branch on the format for every comparison.
+template <depixel::pixel_format F>
+static Color readColor(depixel::image_view const &image, byte const *p)
 {
-	auto diag = merge_nonconflicts(data, delta_c);
+	using enum depixel::pixel_format;
+	if constexpr (F == gray || F == gray_alpha) {
+		return Color(p[0], p[0], p[0]);
+	} else if constexpr (F == indexed) {
+		const byte *entry = image.palette + p[0] * 4;
+		return Color(entry[0], entry[1], entry[2]);
+	} else {
+		return Color(p[0], p[1], p[2]);
+	}
+}
+
+// alpha of the pixel at p, formats without alpha are opaque but for the key
+template <depixel::pixel_format F>
+static byte readAlpha(depixel::image_view const &image, byte const *p)
+{
+	using enum depixel::pixel_format;
+	constexpr size_t channels = F == gray_alpha ? 2 : F == rgb ? 3 : F == rgba ? 4 : 1;
+	if (image.key && std::memcmp(p, image.key, channels) == 0)
+		return 0;
+	if constexpr (F == gray_alpha) {
+		return p[1];
+	} else if constexpr (F == rgba) {
+		return p[3];
+	} else if constexpr (F == indexed) {
+		return image.palette[p[0] * 4 + 3];
+	} else {
+		return 255;
+	}
+}
+
+static byte readAlpha(depixel::image_view const &image, byte const *p)
+{
+	using enum depixel::pixel_format;
+	switch (image.format) {
+	case gray_alpha: return readAlpha<gray_alpha>(image, p);
+	case rgba:       return readAlpha<rgba>(image, p);
+	case indexed:    return readAlpha<indexed>(image, p);
+	case gray:       return readAlpha<gray>(image, p);
+	case rgb:        return readAlpha<rgb>(image, p);
+	}
+	return 255;
+}
+
+Color Vertex::color(depixel::image_view const &image) const
+{
+	using enum depixel::pixel_format;
+	const byte *p = image.pixel(id % image.width, id / image.width);
+	switch (image.format) {
+	case gray:       return readColor<gray>(image, p);
+	case gray_alpha: return readColor<gray_alpha>(image, p);
+	case rgb:        return readColor<rgb>(image, p);
+	case rgba:       return readColor<rgba>(image, p);
+	case indexed:    return readColor<indexed>(image, p);
+	}
+	return Color();
+}
+
+std::optional<Palette> quantise(depixel::image_view const &image)
+{
+	TRACE_SCOPE("quantise");
+	using enum depixel::pixel_format;
+	Palette palette;
+	palette.width = image.width;
+	palette.index.resize(image.width * image.height);
+	// packed RGB, or transparent for every fully transparent pixel
+	static const uint32_t transparent = 1u << 24;
+	std::unordered_map<uint32_t, byte> entries;
+	uint32_t last_key = ~0u;
+	byte last_entry = 0;
+	for (size_t y = 0; y < image.height; ++y) {
+		for (size_t x = 0; x < image.width; ++x) {
+			const auto color = Vertex{ id_t(x + y * image.width) }.color(image);
+			const bool opaque = readAlpha(image, image.pixel(x, y)) != 0;
+			const uint32_t key = opaque ? uint32_t(color.r) << 16 | color.g << 8 | color.b : transparent;
+			if (key != last_key) {
+				auto [entry, added] = entries.try_emplace(key, byte(palette.colors.size()));
+				if (added) {
+					if (palette.colors.size() == 256)
+						return std::nullopt;
+					palette.colors.push_back(color);
+					palette.opaque.push_back(opaque);
+				}
+				last_key = key;
+				last_entry = entry->second;
+			}
+			palette.index[x + y * image.width] = last_entry;
+		}
+	}
+	return palette;
+}
+
+std::vector<byte> Palette::sameColor(int delta_c) const
+{
+	const size_t n = colors.size();
+	std::vector<byte> same(n * n);
+	for (size_t a = 0; a < n; ++a) {
+		for (size_t b = 0; b < n; ++b) {
+			auto d0 = colors[a].r - colors[b].r;
+			auto d1 = colors[a].g - colors[b].g;
+			auto d2 = colors[a].b - colors[b].b;
+			same[a * n + b] = opaque[a] && opaque[b] && d0*d0 + d1*d1 + d2*d2 <= delta_c*delta_c;
+		}
+	}
+	return same;
+}
+
+namespace {
+
+// Reads the colours straight from an image of format F.
+template <depixel::pixel_format F>
+struct DirectPixels
+{
+	depixel::image_view const &image;
+	size_t stride;
+	int delta_c;
+
+	DirectPixels(depixel::image_view const &image, int delta_c)
+		: image(image), stride(image.row_stride()), delta_c(delta_c)
+	{
+	}
+
+	byte const *at(size_t x, size_t y) const
+	{
+		using enum depixel::pixel_format;
+		constexpr size_t channels = F == gray_alpha ? 2 : F == rgb ? 3 : F == rgba ? 4 : 1;
+		return image.pixels + y * stride + x * channels;
+	}
+
+	bool opaque(size_t x, size_t y) const
+	{
+		return readAlpha<F>(image, at(x, y)) != 0;
+	}
+
+	// squared colour distance, never within any delta_c for a transparent pixel
+	uint32_t distance(size_t x0, size_t y0, size_t x1, size_t y1) const
+	{
+		if (!opaque(x0, y0) || !opaque(x1, y1))
+			return UINT32_MAX;
+		const auto a = readColor<F>(image, at(x0, y0));
+		const auto b = readColor<F>(image, at(x1, y1));
+		const int d0 = a.r - b.r;
+		const int d1 = a.g - b.g;
+		const int d2 = a.b - b.b;
+		return d0*d0 + d1*d1 + d2*d2;
+	}
+
+	// never true for a transparent pixel, those only join the background
+	bool similar(size_t x0, size_t y0, size_t x1, size_t y1) const
+	{
+		if (!opaque(x0, y0) || !opaque(x1, y1))
+			return false;
+		const auto a = readColor<F>(image, at(x0, y0));
+		const auto b = readColor<F>(image, at(x1, y1));
+		auto d0 = a.r - b.r;
+		auto d1 = a.g - b.g;
+		auto d2 = a.b - b.b;
+		return d0*d0 + d1*d1 + d2*d2 <= delta_c*delta_c;
+	}
+};
+
+// Compares palette indices through the table of Palette::sameColor.
+struct PalettePixels
+{
+	Palette const &palette;
+	std::vector<byte> same;
+	size_t n;
+
+	PalettePixels(Palette const &palette, int delta_c)
+		: palette(palette), same(palette.sameColor(delta_c)), n(palette.colors.size())
+	{
+	}
+
+	byte entry(size_t x, size_t y) const
+	{
+		return palette.index[x + y * palette.width];
+	}
+
+	bool opaque(size_t x, size_t y) const
+	{
+		return palette.opaque[entry(x, y)];
+	}
+
+	bool similar(size_t x0, size_t y0, size_t x1, size_t y1) const
+	{
+		return same[entry(x0, y0) * n + entry(x1, y1)];
+	}
+};
+
+}
+
+Clusters::Clusters(depixel::image_view const &image, ClusterSweep &sweep, int delta_c)
+	: width(image.width), height(image.height), vertex2cluster(0)
+{
+	TRACE_SCOPE("Clusters");
+	assert(sweep.width == width && sweep.height == height);
+	std::vector<conflict> diag;
+	vertex2cluster = sweep.merge(delta_c, diag);
+	background = sweep.background;
 	conflict_resolution(diag);
+	if (background != id_t(-1)) {
+		background = vertex2cluster.find(background);
+	}
+	reverse_mapping();
+
+	for (const auto &[clust, _] : cluster2vertex) {
+		avg[clust] = average_color(image, clust);
+	}
+}
+
+Clusters::Clusters(depixel::image_view const &image, int delta_c)
+	: width(image.width), height(image.height), vertex2cluster(width * height)
+{
+	TRACE_SCOPE("Clusters");
+	assert(image.format != depixel::pixel_format::indexed || image.palette);
+	const std::optional<Palette> palette = quantise(image);
+
+	using enum depixel::pixel_format;
+	std::vector<conflict> diag;
+	if (palette) {
+		diag = merge_nonconflicts(PalettePixels(*palette, delta_c));
+	} else {
+		switch (image.format) {
+		case gray:       diag = merge_nonconflicts(DirectPixels<gray>(image, delta_c)); break;
+		case gray_alpha: diag = merge_nonconflicts(DirectPixels<gray_alpha>(image, delta_c)); break;
+		case rgb:        diag = merge_nonconflicts(DirectPixels<rgb>(image, delta_c)); break;
+		case rgba:       diag = merge_nonconflicts(DirectPixels<rgba>(image, delta_c)); break;
+		case indexed:    diag = merge_nonconflicts(DirectPixels<indexed>(image, delta_c)); break;
+		}
+	}
+	conflict_resolution(diag);
+	if (background != id_t(-1)) {
+		background = vertex2cluster.find(background);
+	}
 	reverse_mapping();
 	
 	// find all cluster colors
 	for (const auto &[clust, _] : cluster2vertex) {
-		avg[clust] = average_color(data, clust);
+		avg[clust] = palette ? average_color(*palette, clust) : average_color(image, clust);
 	}
 }
 
@@ -20,28 +259,31 @@ id_t Clusters::repr(size_t id)
 {
 	if (id >= vertex2cluster.data.size())
 		return id_t(-1);
-	return vertex2cluster.find(id);
+	// transparent pixels are outside of every shape, like the pixels past the border
+	const auto root = vertex2cluster.find(id);
+	return root == background ? id_t(-1) : root;
 }
 
-std::vector<Clusters::conflict> Clusters::merge_nonconflicts(byte *data, int delta_c)
+template <typename Pixels>
+std::vector<Clusters::conflict> Clusters::merge_nonconflicts(Pixels const &pixels)
 {
 	std::vector<conflict> diagonals;
-	auto index = [=] (size_t x, size_t y) { return x + y * width; };
+	auto index = [=, this] (size_t x, size_t y) { return x + y * width; };
 	vec2<size_t> offsets[] = {
 		{ +1,  0 },
 		{  0, +1 },
 		{ size_t(-1), +1 }, // overflow is fine
 		{ +1, +1 },
 	};
-	auto same_color = [delta_c] (byte *d, size_t a, size_t b) {
-		auto d0 = d[a * 3 + 0] - d[b * 3 + 0];
-		auto d1 = d[a * 3 + 1] - d[b * 3 + 1];
-		auto d2 = d[a * 3 + 2] - d[b * 3 + 2];
-		return d0*d0 + d1*d1 + d2*d2 <= delta_c*delta_c;
-	};
 	for (size_t y = 0; y < height; ++y) {
 		for (size_t x = 0; x < width; ++x) {
 			auto base = index(x, y);
+			if (!pixels.opaque(x, y)) {
+				if (background == id_t(-1))
+					background = base;
+				vertex2cluster.unite(background, base);
+				continue;
+			}
 			// axis-aligned offsets
 			for (size_t ioffset = 0; ioffset < 2; ++ioffset) {
 				vec2<size_t> at_pos{ x + offsets[ioffset].x, y + offsets[ioffset].y };
@@ -49,7 +291,7 @@ std::vector<Clusters::conflict> Clusters::merge_nonconflicts(byte *data, int del
 					continue;
 				}
 				auto at = index(at_pos.x, at_pos.y);
-				if (same_color(data, base, at)) {
+				if (pixels.similar(x, y, at_pos.x, at_pos.y)) {
 					vertex2cluster.unite(base, at);
 				}
 			}
@@ -61,8 +303,8 @@ std::vector<Clusters::conflict> Clusters::merge_nonconflicts(byte *data, int del
 				}
 				auto at = index(at_pos.x, at_pos.y);
 				// when this passes, we know the corresponding pixels adjacent have indices in bounds
-				if (same_color(data, base, at)) {
-					if (same_color(data, at - width, base + width)) {
+				if (pixels.similar(x, y, at_pos.x, at_pos.y)) {
+					if (pixels.similar(at_pos.x, y, x, y + 1)) {
 						// avoid the counter diagonal to add duplicate diagonals
 						if (ioffset != 3) {
 							diagonals.push_back(std::make_pair(base, at));
@@ -80,25 +322,188 @@ std::vector<Clusters::conflict> Clusters::merge_nonconflicts(byte *data, int del
 void Clusters::reverse_mapping()
 {
 	for (id_t i = 0; i < height * width; ++i) {
-		cluster2vertex[vertex2cluster.find(i)].push_back(Vertex{ i });
+		const auto root = vertex2cluster.find(i);
+		if (root != background)
+			cluster2vertex[root].push_back(Vertex{ i });
 	}
 }	
 
-void Clusters::conflict_resolution(std::vector<conflict> const& diagonals)
+// Keeps one diagonal of every 2x2 block where both are the same colour,
+// returns the number of clusters this joined.
+static size_t resolveConflicts(union_find &vertex2cluster, size_t width, std::vector<std::pair<size_t, size_t>> const &diagonals)
 {
+	size_t joined = 0;
 	for (auto [base, at] : diagonals) {
 		id_t main_diag_a = vertex2cluster.find(base);
 		id_t main_diag_b = vertex2cluster.find(at);
 		id_t counter_diag_a = vertex2cluster.find(at - width);
 		id_t counter_diag_b = vertex2cluster.find(base + width);
-		size_t merge_a, merge_b;
 		if (std::min(vertex2cluster.count(main_diag_a), vertex2cluster.count(main_diag_b))
 		  < std::min(vertex2cluster.count(counter_diag_a), vertex2cluster.count(counter_diag_b))) {
+			joined += main_diag_a != main_diag_b;
 			vertex2cluster.unite(main_diag_a, main_diag_b);
 		} else {
+			joined += counter_diag_a != counter_diag_b;
 			vertex2cluster.unite(counter_diag_a, counter_diag_b);
 		}
 	}
+	return joined;
+}
+
+void Clusters::conflict_resolution(std::vector<conflict> const& diagonals)
+{
+	resolveConflicts(vertex2cluster, width, diagonals);
+}
+
+ClusterSweep::ClusterSweep(depixel::image_view const &image)
+	: width(image.width), height(image.height), initial(width * height), swept(width * height)
+{
+	TRACE_SCOPE("ClusterSweep");
+	using enum depixel::pixel_format;
+	switch (image.format) {
+	case gray:       collect(DirectPixels<gray>(image, 0)); break;
+	case gray_alpha: collect(DirectPixels<gray_alpha>(image, 0)); break;
+	case rgb:        collect(DirectPixels<rgb>(image, 0)); break;
+	case rgba:       collect(DirectPixels<rgba>(image, 0)); break;
+	case indexed:    collect(DirectPixels<indexed>(image, 0)); break;
+	}
+	swept = initial;
+}
+
+template <typename Pixels>
+void ClusterSweep::collect(Pixels const &pixels)
+{
+	for (size_t y = 0; y < height; ++y) {
+		for (size_t x = 0; x < width; ++x) {
+			const id_t base = x + y * width;
+			if (!pixels.opaque(x, y)) {
+				if (background == id_t(-1))
+					background = base;
+				initial.unite(background, base);
+				continue;
+			}
+			++opaque;
+			if (x + 1 < width) {
+				axis.push_back(Pair{ pixels.distance(x, y, x + 1, y), base, id_t(base + 1) });
+			}
+			if (y + 1 < height) {
+				axis.push_back(Pair{ pixels.distance(x, y, x, y + 1), base, id_t(base + width) });
+			}
+		}
+	}
+	for (size_t y = 0; y + 1 < height; ++y) {
+		for (size_t x = 0; x + 1 < width; ++x) {
+			blocks.push_back(Block{
+				pixels.distance(x, y, x + 1, y + 1),
+				pixels.distance(x + 1, y, x, y + 1),
+				id_t(x + y * width) });
+		}
+	}
+	// pairs with a transparent pixel never join, leave them out
+	std::erase_if(axis, [] (Pair const &p) { return p.distance == UINT32_MAX; });
+	std::erase_if(blocks, [] (Block const &b) { return std::min(b.main, b.counter) == UINT32_MAX; });
+	std::sort(axis.begin(), axis.end(), [] (Pair const &l, Pair const &r) {
+		return l.distance < r.distance;
+	});
+	std::stable_sort(blocks.begin(), blocks.end(), [] (Block const &l, Block const &r) {
+		return std::min(l.main, l.counter) < std::min(r.main, r.counter);
+	});
+}
+
+void ClusterSweep::sweep(uint32_t limit)
+{
+	if (limit < swept_limit) {
+		swept = initial;
+		swept_end = 0;
+		swept_joined = 0;
+	}
+	swept_limit = limit;
+	for (; swept_end < axis.size() && axis[swept_end].distance <= limit; ++swept_end) {
+		const auto a = swept.find(axis[swept_end].a);
+		const auto b = swept.find(axis[swept_end].b);
+		if (a != b) {
+			swept.unite(a, b);
+			++swept_joined;
+		}
+	}
+}
+
+union_find ClusterSweep::merge(int delta_c, std::vector<std::pair<size_t, size_t>> &conflicts, size_t &joined)
+{
+	const uint32_t limit = delta_c * delta_c;
+	sweep(limit);
+	union_find merged = swept;
+	joined = swept_joined;
+	conflicts.clear();
+	for (const auto &block : blocks) {
+		if (std::min(block.main, block.counter) > limit)
+			break;
+		const size_t tl = block.tl;
+		size_t a, b;
+		if (block.main <= limit && block.counter <= limit) {
+			// recorded from the top right pixel, like Clusters does
+			conflicts.emplace_back(tl + 1, tl + width);
+			continue;
+		} else if (block.main <= limit) {
+			a = merged.find(tl);
+			b = merged.find(tl + width + 1);
+		} else {
+			a = merged.find(tl + 1);
+			b = merged.find(tl + width);
+		}
+		if (a != b) {
+			merged.unite(a, b);
+			++joined;
+		}
+	}
+	std::sort(conflicts.begin(), conflicts.end());
+	return merged;
+}
+
+union_find ClusterSweep::merge(int delta_c, std::vector<std::pair<size_t, size_t>> &conflicts)
+{
+	size_t joined;
+	return merge(delta_c, conflicts, joined);
+}
+
+std::vector<size_t> ClusterSweep::components(int max_delta_c)
+{
+	TRACE_SCOPE("ClusterSweep::components");
+	// one ascending pass on its own copy, the swept unions are left for merge()
+	union_find merged = initial;
+	size_t joined = 0;
+	const auto join = [&] (size_t a, size_t b) {
+		a = merged.find(a);
+		b = merged.find(b);
+		if (a != b) {
+			merged.unite(a, b);
+			++joined;
+		}
+	};
+	std::vector<size_t> counts;
+	size_t next_pair = 0, next_block = 0;
+	for (int delta_c = 0; delta_c <= max_delta_c; ++delta_c) {
+		const uint32_t limit = delta_c * delta_c;
+		for (; next_pair < axis.size() && axis[next_pair].distance <= limit; ++next_pair) {
+			join(axis[next_pair].a, axis[next_pair].b);
+		}
+		for (; next_block < blocks.size() && std::min(blocks[next_block].main, blocks[next_block].counter) <= limit; ++next_block) {
+			const auto &block = blocks[next_block];
+			const size_t tl = block.tl;
+			bool main = block.main < block.counter;
+			if (block.main == block.counter) {
+				// both diagonals at once, the smaller clusters keep theirs like in Clusters
+				main = std::min(merged.count(tl), merged.count(tl + width + 1))
+				     < std::min(merged.count(tl + 1), merged.count(tl + width));
+			}
+			if (main)
+				join(tl, tl + width + 1);
+			else
+				join(tl + 1, tl + width);
+		}
+		counts.push_back(opaque - joined);
+	}
+	return counts;
 }
 
 size_t Clusters::components() const
@@ -106,14 +511,25 @@ size_t Clusters::components() const
 	return cluster2vertex.size();
 }
 
-Color Clusters::average_color(byte *data, id_t clust)
+Color Clusters::average_color(depixel::image_view const &image, id_t clust)
+{
+	return average_color(clust, [&] (Vertex v) { return v.color(image); });
+}
+
+Color Clusters::average_color(Palette const &palette, id_t clust)
+{
+	return average_color(clust, [&] (Vertex v) { return palette.colors[palette.index[v.id]]; });
+}
+
+template <typename ColorOf>
+Color Clusters::average_color(id_t clust, ColorOf &&color_of)
 {
 	auto &cluster = cluster2vertex[clust];
 	if (cluster.empty()) return Color();
 
 	long totalR = 0, totalG = 0, totalB = 0;
 	for (const auto& vertex : cluster) {
-		auto color = vertex.color(data);
+		auto color = color_of(vertex);
 		totalR += color.r;
 		totalG += color.g;
 		totalB += color.b;
@@ -134,6 +550,22 @@ Color Clusters::average_color(id_t clust) const
 	return pos->second;
 }
 
+LabelImage Clusters::labels() const
+{
+	TRACE_SCOPE("Clusters::labels");
+	LabelImage image{ width, height, {}, {} };
+	image.label.assign((width + 2) * (height + 2), LabelImage::outside);
+	image.cluster.reserve(cluster2vertex.size());
+	for (const auto &[clust, vertices] : cluster2vertex) {
+		const id_t compact = image.cluster.size();
+		image.cluster.push_back(clust);
+		for (const auto vertex : vertices) {
+			image.label[(vertex.id / width + 1) * image.stride() + vertex.id % width + 1] = compact;
+		}
+	}
+	return image;
+}
+
 std::map<id_t, Clusters::cluster> const &Clusters::get() const
 {
 	return cluster2vertex;
@@ -0,0 +1,232 @@
+#include "depixel.hpp"
+#include "mesh.hpp"
+#include "trace.hpp"
+#include <cassert>
+#include <cstring>
+#include <optional>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+namespace depixel {
+
+// every stage of the conversion, result::svg only holds the shapes
+static result convert(image_view image, params const &p)
+{
+	assert(image.pixels && image.width > 0 && image.height > 0);
+	auto mark = std::chrono::steady_clock::now();
+	auto stage = [&] (const char *name) {
+		if (!p.on_stage)
+			return;
+		const auto now = std::chrono::steady_clock::now();
+		p.on_stage(name, std::chrono::duration<double, std::milli>(now - mark).count());
+		mark = now;
+	};
+
+	Clusters clusters(image, p.delta_c);
+	stage("clusters");
+	Mesh mesh = p.trace_contours ? traceShapes(clusters, image.width, image.height, nullptr, p.arity)
+	                             : buildShapes(clusters, image.width, image.height, nullptr, p.arity);
+	stage("buildShapes");
+	std::optional<Decimation> coarse;
+	if (p.decimate)
+		coarse = decimateCollinear(mesh);
+	Mesh const &solved = coarse ? coarse->mesh : mesh;
+	stage("decimateCollinear");
+	// the outlines are drawn from whichever mesh the positions belong to
+	const bool dense = coarse && p.densify;
+	BoundaryGraph bnd = clusterBoundaries(dense ? mesh : solved);
+	stage("clusterBoundaries");
+	ForceModel model = buildForceModel(solved);
+	stage("buildForceModel");
+
+	result out;
+	Solver solver(model, p.active_set);
+	if (p.multilevel)
+		out.coarse_iterations = warmStart(solver, solved, coarsenLevels(solved), p.k0, p.kN);
+	while (p.max_iterations == 0 || out.iterations < p.max_iterations) {
+		++out.iterations;
+		if (solver.step(p.k0, p.kN) <= force_threshold) {
+			out.converged = true;
+			break;
+		}
+	}
+	stage("applyForces");
+
+	if (dense)
+		out.svg = serializeShapes(clusters, bnd, coarse->densify(solver.vert));
+	else
+		out.svg = serializeShapes(clusters, bnd, solver.vert);
+	stage("serializeSVG");
+	out.clusters = clusters.components();
+	out.mesh_nodes = mesh.vert.size();
+	out.mesh_edges = mesh.edges();
+	out.nodes = solved.vert.size();
+	out.vertex_updates = solver.updates;
+	return out;
+}
+
+result depixelize(image_view image, params const &p)
+{
+	TRACE_SCOPE("depixelize");
+	auto out = convert(image, p);
+	out.svg = serializeSVG(out.svg);
+	return out;
+}
+
+static bool overlap(sprite_box const &a, sprite_box const &b)
+{
+	return a.x < b.x + b.width && b.x < a.x + a.width
+	    && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+static bool transparent(image_view const &image, size_t x, size_t y)
+{
+	const auto *p = image.pixel(x, y);
+	switch (image.format) {
+	case pixel_format::gray_alpha: return p[1] == 0;
+	case pixel_format::rgba:       return p[3] == 0;
+	case pixel_format::indexed:    return image.palette[p[0] * 4 + 3] == 0;
+	default:                       return false;
+	}
+}
+
+std::vector<sprite_box> findSprites(image_view image, atlas_params const &a)
+{
+	TRACE_SCOPE("findSprites");
+	const size_t channels = image.channels();
+	const bool clear = transparent(image, 0, 0);
+	auto background = [&] (size_t x, size_t y) {
+		if (clear)
+			return transparent(image, x, y);
+		return std::memcmp(image.pixel(x, y), image.pixels, channels) == 0;
+	};
+
+	std::vector<sprite_box> boxes;
+	if (a.grid_width && a.grid_height) {
+		for (size_t y0 = 0; y0 < image.height; y0 += a.grid_height) {
+			for (size_t x0 = 0; x0 < image.width; x0 += a.grid_width) {
+				const sprite_box cell{ x0, y0,
+					std::min(a.grid_width, image.width - x0),
+					std::min(a.grid_height, image.height - y0) };
+				bool empty = true;
+				for (size_t y = cell.y; empty && y < cell.y + cell.height; ++y) {
+					for (size_t x = cell.x; empty && x < cell.x + cell.width; ++x) {
+						empty = background(x, y);
+					}
+				}
+				if (!empty)
+					boxes.push_back(cell);
+			}
+		}
+		return boxes;
+	}
+
+	// bounding boxes of the 8-connected regions of foreground pixels
+	std::vector<bool> seen(image.width * image.height);
+	std::vector<vec2<size_t>> stack;
+	for (size_t y0 = 0; y0 < image.height; ++y0) {
+		for (size_t x0 = 0; x0 < image.width; ++x0) {
+			if (seen[x0 + y0 * image.width] || background(x0, y0))
+				continue;
+			size_t x_min = x0, x_max = x0, y_min = y0, y_max = y0;
+			seen[x0 + y0 * image.width] = true;
+			stack.emplace_back(x0, y0);
+			while (!stack.empty()) {
+				const auto [x, y] = stack.back();
+				stack.pop_back();
+				x_min = std::min(x_min, x);
+				x_max = std::max(x_max, x);
+				y_min = std::min(y_min, y);
+				y_max = std::max(y_max, y);
+				for (size_t ny = y ? y - 1 : 0; ny <= std::min(y + 1, image.height - 1); ++ny) {
+					for (size_t nx = x ? x - 1 : 0; nx <= std::min(x + 1, image.width - 1); ++nx) {
+						if (seen[nx + ny * image.width] || background(nx, ny))
+							continue;
+						seen[nx + ny * image.width] = true;
+						stack.emplace_back(nx, ny);
+					}
+				}
+			}
+			boxes.push_back(sprite_box{ x_min, y_min, x_max - x_min + 1, y_max - y_min + 1 });
+		}
+	}
+
+	// a sprite must not see the pixels of another one, join boxes that overlap
+	for (bool merged = true; merged;) {
+		merged = false;
+		for (size_t i = 0; i < boxes.size(); ++i) {
+			for (size_t j = i + 1; j < boxes.size(); ++j) {
+				if (!overlap(boxes[i], boxes[j]))
+					continue;
+				auto &b = boxes[i];
+				const auto x_end = std::max(b.x + b.width, boxes[j].x + boxes[j].width);
+				const auto y_end = std::max(b.y + b.height, boxes[j].y + boxes[j].height);
+				b.x = std::min(b.x, boxes[j].x);
+				b.y = std::min(b.y, boxes[j].y);
+				b.width = x_end - b.x;
+				b.height = y_end - b.y;
+				boxes.erase(boxes.begin() + j);
+				merged = true;
+				--j;
+			}
+		}
+	}
+	std::sort(boxes.begin(), boxes.end(), [] (sprite_box const &l, sprite_box const &r) {
+		return l.y != r.y ? l.y < r.y : l.x < r.x;
+	});
+	return boxes;
+}
+
+atlas_result depixelizeAtlas(image_view image, params const &p, atlas_params const &a)
+{
+	TRACE_SCOPE("depixelizeAtlas");
+	const auto boxes = findSprites(image, a);
+	// a solid background would be a shape of its own around every sprite, key it out
+	if (!transparent(image, 0, 0))
+		image.key = image.pixels;
+	std::vector<std::string> shapes(boxes.size());
+	atlas_result atlas;
+	atlas.sprites.resize(boxes.size());
+
+	// sprites are independent, workers take the next one until none is left
+	std::atomic<size_t> next{0};
+	auto work = [&] {
+		for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < boxes.size();) {
+			const auto &box = boxes[i];
+			auto &sprite = atlas.sprites[i];
+			sprite.box = box;
+			sprite.out = convert(image.crop(box.x, box.y, box.width, box.height), p);
+			shapes[i] = sprite.out.svg;
+			sprite.out.svg = serializeSVG(shapes[i]);
+		}
+	};
+	const size_t threads = std::min<size_t>(a.threads ? a.threads : std::max(1u, std::thread::hardware_concurrency()), boxes.size());
+	std::vector<std::thread> workers;
+	for (size_t t = 1; t < threads; ++t) {
+		workers.emplace_back(work);
+	}
+	work();
+	for (auto &worker : workers) {
+		worker.join();
+	}
+
+	std::stringstream svg;
+	svg << R"(<?xml version="1.0"?>)" << '\n';
+	svg << "<svg width=\"" << image.width * 25 << "\" height=\"" << image.height * 25
+	    << "\" viewBox=\"0 0 " << image.width * 25 << ' ' << image.height * 25
+	    << R"(" xmlns="http://www.w3.org/2000/svg">)" << '\n';
+	for (size_t i = 0; i < boxes.size(); ++i) {
+		svg << "<g id=\"sprite" << i << "\" transform=\"translate("
+		    << boxes[i].x * 25 << ' ' << boxes[i].y * 25 << ")\">\n"
+		    << shapes[i]
+		    << "</g>\n";
+	}
+	svg << "</svg>\n";
+	atlas.svg = svg.str();
+	return atlas;
+}
+
+}
@@ -0,0 +1,406 @@
+#include "mesh.hpp"
+#include "trace.hpp"
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+// Shoelace area of the polygon through vert[nodes[0]], vert[nodes[1]], ...
+// The coordinates are gathered into contiguous arrays first, so the cross
+// products run in independent lanes the compiler turns into vector code.
+static float signedArea(std::span<const Mesh::node_t> nodes, std::vector<vec2<float>> const &vert, std::vector<float> &xs, std::vector<float> &ys)
+{
+	const size_t n = nodes.size();
+	if (n < 3) {
+		return 0.0f;
+	}
+	xs.resize(n + 1);
+	ys.resize(n + 1);
+	for (size_t i = 0; i < n; ++i) {
+		xs[i] = vert[nodes[i]].x;
+		ys[i] = vert[nodes[i]].y;
+	}
+	xs[n] = xs[0];
+	ys[n] = ys[0];
+
+	static const size_t LANES = 8;
+	float lane[LANES] = {};
+	const float *x = xs.data();
+	const float *y = ys.data();
+	size_t i = 0;
+	for (; i + LANES <= n; i += LANES) {
+		for (size_t l = 0; l < LANES; ++l) {
+			lane[l] += x[i+l] * y[i+l+1] - x[i+l+1] * y[i+l];
+		}
+	}
+	float area = 0.0f;
+	for (; i < n; ++i) {
+		area += x[i] * y[i+1] - x[i+1] * y[i];
+	}
+	for (size_t l = 0; l < LANES; ++l) {
+		area += lane[l];
+	}
+	return area / 2.0f;
+}
+
+ClusterGraph clusterGraph(Mesh const &mesh)
+{
+	TRACE_SCOPE("clusterGraph");
+	ClusterGraph graph;
+	std::vector<float> xs, ys;
+	for (size_t f = 0; f < mesh.faces(); ++f) {
+		const auto cluster = mesh.face_cluster[f];
+		const auto ring = mesh.ring(f);
+		if (cluster == id_t(-1) || ring.size() < 3)
+			continue;
+		Polygon p;
+		p.nodes.assign(ring.begin(), ring.end());
+		p.signed_area = signedArea(p.nodes, mesh.vert, xs, ys);
+		// faces wind so that only holes have a positive area
+		p.containment_level = p.signed_area > 0.0f;
+		graph[cluster].push_back(std::move(p));
+	}
+	return graph;
+}
+
+std::pair<std::unordered_map<id_t, float>, std::unordered_map<id_t, vec2<float>>> calculateClusterAreas(
+	const std::unordered_map<size_t, std::vector<size_t>>& cluster_nodes,
+	const std::vector<vec2<float>>& vert,
+	ClusterGraph const& cluster_graph)
+{
+	std::unordered_map<id_t, float> cluster_total_areas;
+	std::vector<float> xs, ys;
+
+	for (const auto& [cluster_id, polygons] : cluster_graph) {
+        float net_area = 0.0f;
+        for (const auto& p : polygons) {
+            const float area = std::abs(signedArea(p.nodes, vert, xs, ys));
+            if (p.containment_level % 2 == 1) {
+                net_area -= area;
+            } else {
+                net_area += area;
+            }
+        }
+        cluster_total_areas[cluster_id] = net_area;
+    }
+
+	std::unordered_map<id_t, vec2<float>> cluster_centers;
+	for (const auto& [cluster_id, nodes] : cluster_nodes) {
+		vec2<float> sum{0.0, 0.0};
+		for (size_t idx : nodes) {
+			sum = sum + vert[idx];
+		}
+		if (!nodes.empty()) {
+			sum = sum / static_cast<float>(nodes.size());
+		}
+		cluster_centers[cluster_id] = sum;
+	}
+
+	return std::make_pair(cluster_total_areas, cluster_centers);
+	
+}
+
+ForceModel buildForceModel(Mesh const &mesh)
+{
+	TRACE_SCOPE("buildForceModel");
+	ForceModel model;
+	model.vert0 = mesh.vert;
+	const auto &node_cluster_ids = mesh.node_cluster_ids;
+	const size_t n_nodes         = node_cluster_ids.size();
+
+	model.vertex_clusters.resize(n_nodes);
+	for (size_t i = 0; i < n_nodes; ++i) {
+		for (const auto c : node_cluster_ids[i]) {
+			model.cluster_nodes[c].push_back(i);
+			model.vertex_clusters[i].push_back(c);
+		}
+	}
+
+	// The mesh holds every edge once, so its half-edges only need sorting.
+	// Zero length springs in series act as one of their stiffness over their
+	// count, so an edge standing for a straight run is that much softer.
+	model.adj_start = mesh.edge_start;
+	std::vector<uint32_t> order(mesh.half_edge.size());
+	std::iota(order.begin(), order.end(), 0);
+	for (size_t u = 0; u < n_nodes; ++u) {
+		std::sort(order.begin() + model.adj_start[u], order.begin() + model.adj_start[u+1], [&] (uint32_t a, uint32_t b) {
+			return mesh.half_edge[a].to < mesh.half_edge[b].to;
+		});
+	}
+	model.adj.reserve(order.size());
+	model.adj_weight.reserve(order.size());
+	for (const auto h : order) {
+		const auto half = mesh.half_edge[h];
+		model.adj.push_back(half.to);
+		model.adj_weight.push_back(mesh.edge_span.empty() ? 1.0f : 1.0f / float(mesh.edge_span[half.edge]));
+	}
+
+	model.cluster_graph = clusterGraph(mesh);
+	model.areas0 = calculateClusterAreas(model.cluster_nodes, model.vert0, model.cluster_graph).first;
+
+	model.ring_start.assign(n_nodes + 1, 0);
+	for (const auto &[cluster, polygons] : model.cluster_graph) {
+		for (const auto &p : polygons) {
+			for (const auto u : p.nodes)
+				++model.ring_start[u+1];
+		}
+	}
+	for (size_t u = 0; u < n_nodes; ++u)
+		model.ring_start[u+1] += model.ring_start[u];
+	model.ring_corner.resize(model.ring_start.back());
+	std::vector<uint32_t> fill(model.ring_start.begin(), model.ring_start.end() - 1);
+	for (const auto &[cluster, polygons] : model.cluster_graph) {
+		for (const auto &p : polygons) {
+			const size_t n = p.nodes.size();
+			for (size_t i = 0; i < n; ++i) {
+				model.ring_corner[fill[p.nodes[i]]++] = ForceModel::RingCorner{
+					cluster, p.nodes[(i + n - 1) % n], p.nodes[(i + 1) % n] };
+			}
+		}
+	}
+	return model;
+}
+
+static const float eta = 0.003;
+
+float Solver::step(float k0, float kN)
+{
+	if (active_set)
+		return stepActive(k0, kN);
+	TRACE_SCOPE("Solver::step");
+	const auto &vert0 = model.vert0;
+	float max_force = 0.0f;
+
+	auto [areas, centers] = calculateClusterAreas(model.cluster_nodes, vert, model.cluster_graph);
+
+	for (size_t u = 0; u < vert.size(); ++u) {
+		vec2<float> force = {0.0, 0.0};
+
+		if (model.adj_start[u] == model.adj_start[u+1]) continue;
+
+		// Local Spring
+		force = force + (vert0[u] - vert[u]) * k0 * (vert0[u] - vert[u]).length();
+
+		// Neighbor springs
+		for (size_t i = model.adj_start[u]; i < model.adj_start[u+1]; ++i) {
+			force = force + (vert[model.adj[i]] - vert[u]) * (kN * model.adj_weight[i]);
+		}
+
+		// Area forces
+		for (id_t c: model.vertex_clusters[u]){
+			float area = areas[c];
+			float area0 = model.areas0.at(c);
+			vec2<float> center = centers[c];
+
+			force = force + (vert[u] - center) * (1.0f - std::sqrt(area / area0));
+		}
+		if (force.length() > max_force)
+			max_force = force.length();
+
+		vert[u] = vert[u] + force * eta;
+	}
+	updates += vert.size();
+	return max_force;
+}
+
+void Solver::startActive()
+{
+	const size_t n_nodes = vert.size();
+	for (Mesh::node_t u = 0; u < n_nodes; ++u) {
+		if (model.adj_start[u] != model.adj_start[u+1])
+			active.push_back(u);
+	}
+	queued.assign(n_nodes, 0);
+	calm.assign(n_nodes, 0);
+	drift.assign(n_nodes, 0.0f);
+
+	size_t n_clusters = 0;
+	for (const auto &clusters : model.vertex_clusters) {
+		for (const auto c : clusters)
+			n_clusters = std::max<size_t>(n_clusters, c + 1);
+	}
+	area0.assign(n_clusters, 0.0f);
+	for (const auto &[c, a] : model.areas0)
+		area0[c] = a;
+	dirty.assign(n_clusters, 0);
+	recount();
+}
+
+void Solver::recount()
+{
+	const size_t n_clusters = area0.size();
+	area.assign(n_clusters, 0.0);
+	center_sum.assign(n_clusters, vec2<double>(0.0, 0.0));
+	center_count.assign(n_clusters, 0.0);
+	// outer rings wind negative and holes positive, so the net area is minus their sum
+	for (Mesh::node_t u = 0; u < vert.size(); ++u) {
+		for (auto i = model.ring_start[u]; i < model.ring_start[u+1]; ++i) {
+			const auto &corner = model.ring_corner[i];
+			area[corner.cluster] -= 0.5 * (double(vert[u].x) * vert[corner.next].y - double(vert[corner.next].x) * vert[u].y);
+		}
+		for (const auto c : model.vertex_clusters[u]) {
+			center_sum[c] = center_sum[c] + vec2<double>(vert[u].x, vert[u].y);
+			center_count[c] += 1.0;
+		}
+	}
+	ratio_seen.resize(n_clusters);
+	center_seen.resize(n_clusters);
+	for (size_t c = 0; c < n_clusters; ++c) {
+		ratio_seen[c] = ratio(c);
+		center_seen[c] = center(c);
+	}
+}
+
+vec2<float> Solver::activeForce(Mesh::node_t u, float k0, float kN) const
+{
+	const auto &vert0 = model.vert0;
+	vec2<float> force = (vert0[u] - vert[u]) * k0 * (vert0[u] - vert[u]).length();
+	for (size_t i = model.adj_start[u]; i < model.adj_start[u+1]; ++i) {
+		force = force + (vert[model.adj[i]] - vert[u]) * (kN * model.adj_weight[i]);
+	}
+	for (id_t c : model.vertex_clusters[u]) {
+		force = force + (vert[u] - center(c)) * (1.0f - std::sqrt(ratio(c)));
+	}
+	return force;
+}
+
+// Once the active vertices are all under the threshold the running areas are
+// recounted and every force evaluated, so the run only settles where a full
+// step would; the vertices still over the threshold become active again.
+float Solver::confirmSettled(float k0, float kN)
+{
+	TRACE_SCOPE("Solver::confirmSettled");
+	recount();
+	for (const auto v : active)
+		queued[v] = 1;
+	float max_force = 0.0f;
+	for (Mesh::node_t u = 0; u < vert.size(); ++u) {
+		if (model.adj_start[u] == model.adj_start[u+1])
+			continue;
+		const float length = activeForce(u, k0, kN).length();
+		max_force = std::max(max_force, length);
+		if (length > force_threshold) {
+			calm[u] = 0;
+			if (!queued[u])
+				active.push_back(u);
+		}
+	}
+	std::sort(active.begin(), active.end());
+	for (const auto v : active)
+		queued[v] = 0;
+	return max_force;
+}
+
+float Solver::stepActive(float k0, float kN)
+{
+	TRACE_SCOPE("Solver::stepActive");
+	if (area0.empty())
+		startActive();
+	float max_force = 0.0f;
+
+	still_active.clear();
+	const auto enqueue = [&] (Mesh::node_t v) {
+		if (!queued[v]) {
+			queued[v] = 1;
+			still_active.push_back(v);
+		}
+	};
+	const auto wake = [&] (Mesh::node_t v) {
+		if (calm[v] == settle_sweeps)
+			calm[v] = 0;
+		enqueue(v);
+	};
+	changed.clear();
+	for (const auto u : active) {
+		const auto force = activeForce(u, k0, kN);
+		const float length = force.length();
+		max_force = std::max(max_force, length);
+
+		const auto move = force * eta;
+		vert[u] = vert[u] + move;
+		for (auto i = model.ring_start[u]; i < model.ring_start[u+1]; ++i) {
+			const auto &corner = model.ring_corner[i];
+			const auto prev = vert[corner.prev], next = vert[corner.next];
+			area[corner.cluster] -= 0.5 * (double(move.x) * (next.y - prev.y) + double(move.y) * (prev.x - next.x));
+		}
+		for (id_t c : model.vertex_clusters[u]) {
+			center_sum[c] = center_sum[c] + vec2<double>(move.x, move.y);
+			if (!dirty[c]) {
+				dirty[c] = 1;
+				changed.push_back(c);
+			}
+		}
+
+		calm[u] = length <= force_threshold ? std::min<uint8_t>(calm[u] + 1, settle_sweeps) : 0;
+		drift[u] += move.length();
+		if (drift[u] > wake_distance) {
+			drift[u] = 0.0f;
+			for (size_t i = model.adj_start[u]; i < model.adj_start[u+1]; ++i)
+				wake(model.adj[i]);
+		}
+		if (calm[u] < settle_sweeps)
+			enqueue(u);
+	}
+	updates += active.size();
+
+	// the area force of a frozen vertex follows its whole cluster, not just its neighbours
+	for (const auto c : changed) {
+		dirty[c] = 0;
+		const float now = ratio(c);
+		const auto at = center(c);
+		if (std::abs(now - ratio_seen[c]) <= wake_ratio && (at - center_seen[c]).length() <= wake_distance)
+			continue;
+		ratio_seen[c] = now;
+		center_seen[c] = at;
+		for (const auto v : model.cluster_nodes.at(c)) {
+			if (model.adj_start[v] != model.adj_start[v+1])
+				wake(v);
+		}
+	}
+
+	std::sort(still_active.begin(), still_active.end());
+	for (const auto v : still_active)
+		queued[v] = 0;
+	std::swap(active, still_active);
+	if (max_force <= force_threshold)
+		return confirmSettled(k0, kN);
+	return max_force;
+}
+
+size_t warmStart(Solver &solver, Mesh const &mesh, std::span<const Decimation> levels, float k0, float kN)
+{
+	TRACE_SCOPE("warmStart");
+	if (levels.empty())
+		return 0;
+	size_t sweeps = 0;
+	std::vector<vec2<float>> pos = levels.back().mesh.vert;
+	for (size_t level = levels.size(); level-- > 0; ) {
+		const ForceModel model = buildForceModel(levels[level].mesh);
+		Solver coarse(model, solver.uses_active_set());
+		coarse.vert = std::move(pos);
+		// only a warm start, the fine level settles what the coarse one leaves
+		const size_t budget = coarse_sweeps_per_node * model.vert0.size();
+		for (size_t i = 0; i < budget; ++i) {
+			++sweeps;
+			if (coarse.step(k0, kN) <= force_threshold)
+				break;
+		}
+		Mesh const &fine = level ? levels[level-1].mesh : mesh;
+		pos = levels[level].prolong(coarse.vert, fine.vert);
+	}
+	solver.vert = std::move(pos);
+	return sweeps;
+}
+
+std::vector<vec2<float>> applyForces(ForceModel const &model, float k0, float kN)
+{
+	TRACE_SCOPE("applyForces");
+	Solver solver(model);
+	while (solver.step(k0, kN) > force_threshold) {
+	}
+	return std::move(solver.vert);
+}
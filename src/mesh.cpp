@@ -0,0 +1,700 @@
+#include "mesh.hpp"
+#include "trace.hpp"
+#include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory_resource>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// edge to a higher numbered node, while the mesh is assembled
+struct EdgeEnd {
+	size_t endpoint;
+	id_t clust1;
+	id_t clust2;
+
+	auto operator<=>(EdgeEnd const &r) const
+	{
+		return endpoint <=> r.endpoint;
+	}
+};
+
+// Bit o of mask[x + y * width] is set when side o of the pixel (top, left,
+// bottom, right) borders another cluster; boundary lists the pixels with any
+// bit set, in raster order.
+struct SideMasks {
+	std::pmr::vector<uint8_t> mask;
+	std::pmr::vector<uint32_t> boundary;
+};
+
+uint8_t sideMask(id_t const *at, size_t stride)
+{
+	const auto current = at[0];
+	if (current == LabelImage::outside)
+		return 0;
+	return (at[-ptrdiff_t(stride)] != current) << 0
+	     | (at[-1] != current)                 << 1
+	     | (at[+stride] != current)            << 2
+	     | (at[+1] != current)                 << 3;
+}
+
+// The padding lets every pixel read its four neighbours unchecked, four
+// pixels at a time with SSE2.
+SideMasks sideMasks(LabelImage const &labels, std::pmr::memory_resource *arena)
+{
+	TRACE_SCOPE("sideMasks");
+	const size_t width = labels.width;
+	const size_t stride = labels.stride();
+	SideMasks sides{ std::pmr::vector<uint8_t>(width * labels.height, arena), std::pmr::vector<uint32_t>(arena) };
+	for (size_t y = 0; y < labels.height; ++y) {
+		id_t const *row = labels.label.data() + (y + 1) * stride + 1;
+		uint8_t *mask = sides.mask.data() + y * width;
+		size_t x = 0;
+#if defined(__SSE2__)
+		const __m128i outside = _mm_set1_epi32(int(LabelImage::outside));
+		const __m128i bits = _mm_set_epi32(8, 4, 2, 1);
+		for (; x + 4 <= width; x += 4) {
+			const auto load = [&] (ptrdiff_t offset) {
+				return _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x + offset));
+			};
+			const __m128i current = load(0);
+			const __m128i same_top    = _mm_cmpeq_epi32(current, load(-ptrdiff_t(stride)));
+			const __m128i same_left   = _mm_cmpeq_epi32(current, load(-1));
+			const __m128i same_bottom = _mm_cmpeq_epi32(current, load(+ptrdiff_t(stride)));
+			const __m128i same_right  = _mm_cmpeq_epi32(current, load(+1));
+			// one lane per pixel, its four side bits in the low byte
+			__m128i m = _mm_andnot_si128(same_top, _mm_shuffle_epi32(bits, 0x00));
+			m = _mm_or_si128(m, _mm_andnot_si128(same_left,   _mm_shuffle_epi32(bits, 0x55)));
+			m = _mm_or_si128(m, _mm_andnot_si128(same_bottom, _mm_shuffle_epi32(bits, 0xaa)));
+			m = _mm_or_si128(m, _mm_andnot_si128(same_right,  _mm_shuffle_epi32(bits, 0xff)));
+			m = _mm_andnot_si128(_mm_cmpeq_epi32(current, outside), m);
+			m = _mm_packus_epi16(_mm_packs_epi32(m, m), m);
+			const uint32_t packed = _mm_cvtsi128_si32(m);
+			std::memcpy(mask + x, &packed, 4);
+			if (packed == 0)
+				continue;
+			for (size_t i = 0; i < 4; ++i) {
+				if (mask[x + i])
+					sides.boundary.push_back(x + i + y * width);
+			}
+		}
+#endif
+		for (; x < width; ++x) {
+			mask[x] = sideMask(row + x, stride);
+			if (mask[x])
+				sides.boundary.push_back(x + y * width);
+		}
+	}
+	return sides;
+}
+
+
+struct SideOffset {
+	// neighbour across the side
+	vec2<size_t> pixel;
+	// start corner of the side, the end corner is the start of the next one
+	vec2<size_t> start;
+	// from the start to the end corner
+	vec2<size_t> dir;
+};
+
+constexpr SideOffset side_offset[] = {
+	{ { 0, size_t(-1) }, { 1, 0 }, { size_t(-1), 0 } },
+	{ { size_t(-1), 0 }, { 0, 0 }, { 0, size_t(+1) } },
+	{ { 0, size_t(+1) }, { 0, 1 }, { size_t(+1), 0 } },
+	{ { size_t(+1), 0 }, { 1, 1 }, { 0, size_t(-1) } },
+};
+
+// How a corner is split: by no diagonal, by the main one joining its top
+// left and bottom right pixels, or by the counter one.
+enum Diagonal : size_t {
+	None,
+	Main,
+	Counter,
+};
+
+// Which of its two nodes a corner gives the start (is_end 0) and the end
+// (is_end 1) of side o, at corner_split[diagonal][o<<1|is_end]. The sides
+// on one side of a splitting diagonal share a node; where no diagonal
+// splits the corner all do.
+constexpr auto corner_split = [] {
+	std::array<std::array<uint8_t, 8>, 3> split{};
+	for (size_t end = 0; end < 8; ++end) {
+		split[Main][end]    = 0b01011010 >> end & 1;
+		split[Counter][end] = 0b10010110 >> end & 1;
+	}
+	return split;
+}();
+
+// pixel side between two clusters, from the start to the end corner in lattice units
+template <size_t ARITY>
+struct Side {
+	// nodes sit on a lattice of STEPS points per pixel, ARITY inside every side
+	static constexpr size_t STEPS = ARITY + 1;
+
+	vec2<size_t> start;
+	vec2<size_t> dir;
+	size_t o;
+	id_t current;
+	id_t neighbr;
+
+	Side(LabelImage const &labels, size_t x, size_t y, size_t o)
+		: start((x + side_offset[o].start.x) * STEPS, (y + side_offset[o].start.y) * STEPS),
+		  dir(side_offset[o].dir), o(o), current(labels.at(x, y)),
+		  neighbr(labels.at(x + side_offset[o].pixel.x, y + side_offset[o].pixel.y))
+	{
+	}
+
+	vec2<size_t> at(size_t step) const
+	{
+		return { start.x + dir.x * step, start.y + dir.y * step };
+	}
+};
+
+// Dense index from lattice points to nodes: ARITY points inside every
+// horizontal then every vertical pixel side, then two per pixel corner,
+// one for each side of a diagonal splitting it. Coincident nodes share
+// their key, so they are one node by construction.
+template <size_t ARITY>
+struct Lattice {
+	static constexpr size_t STEPS = ARITY + 1;
+
+	LabelImage const &labels;
+	size_t width;
+	size_t height;
+	size_t horizontal;
+	size_t corner_keys;
+
+	explicit Lattice(LabelImage const &labels)
+		: labels(labels), width(labels.width), height(labels.height),
+		  horizontal((height + 1) * width * ARITY),
+		  corner_keys(horizontal + (width + 1) * height * ARITY)
+	{
+	}
+
+	size_t size() const
+	{
+		return corner_keys + 2 * (width + 1) * (height + 1);
+	}
+
+	size_t edge_key(vec2<size_t> l) const
+	{
+		if (l.y % STEPS == 0)
+			return (l.y / STEPS * width + l.x / STEPS) * ARITY + l.x % STEPS - 1;
+		return horizontal + (l.x / STEPS * height + l.y / STEPS) * ARITY + l.y % STEPS - 1;
+	}
+
+	// a diagonal joins two pixels of one cluster the other two do not belong to
+	size_t corner_key(vec2<size_t> l, size_t o, size_t is_end) const
+	{
+		const size_t cx = l.x / STEPS;
+		const size_t cy = l.y / STEPS;
+		const auto main1 = labels.at(cx-1, cy-1);
+		const auto main2 = labels.at(cx  , cy  );
+		const auto cntr1 = labels.at(cx  , cy-1);
+		const auto cntr2 = labels.at(cx-1, cy  );
+		const Diagonal diagonal =
+			main1 == main2 && main1 != cntr1 && main1 != cntr2 ? Main :
+			cntr1 == cntr2 && cntr1 != main1 && cntr1 != main2 ? Counter : None;
+		return corner_keys + (cy * (width + 1) + cx) * 2 + corner_split[diagonal][o<<1|is_end];
+	}
+
+	// keys of every node of a side: ARITY edge nodes along it, then its two corners
+	std::array<size_t, ARITY + 2> side_keys(Side<ARITY> const &side) const
+	{
+		std::array<size_t, ARITY + 2> keys;
+		for (size_t edge_node = 0; edge_node < ARITY; ++edge_node)
+			keys[edge_node] = edge_key(side.at(edge_node+1));
+		keys[ARITY  ] = corner_key(side.start, side.o, 0);
+		keys[ARITY+1] = corner_key(side.at(STEPS), side.o, 1);
+		return keys;
+	}
+};
+
+// edge from a to b, a < b, and the faces of the half-edges a to b and b to a
+struct EdgeRecord {
+	Mesh::node_t a;
+	Mesh::node_t b;
+	id_t clust1;
+	id_t clust2;
+};
+
+// CSR adjacency, cluster pairs and faces of the edges, in their order
+Mesh assembleMesh(std::vector<vec2<float>> nodes, std::vector<ClusterSet> node_cluster_ids,
+	std::span<const EdgeRecord> edges, std::vector<id_t> cluster_id,
+	std::pmr::memory_resource *arena, Preview *preview)
+{
+	TRACE_SCOPE("assembleMesh");
+	TRACE_PHASE(phase, "assembleMesh: adjacency");
+	std::vector<vec4<float>> lines;
+	if (preview) {
+		for (const auto &e : edges)
+			lines.push_back(vec4<float>(nodes[e.a].x, nodes[e.a].y, nodes[e.b].x, nodes[e.b].y));
+		preview->submit(lines, vec4<float>(1.0f, 1.0f, 1.0f, 1.0f));
+		preview->draw();
+	}
+
+	Mesh mesh;
+	mesh.edge_start.assign(nodes.size() + 1, 0);
+	for (const auto &e : edges) {
+		++mesh.edge_start[e.a+1];
+		++mesh.edge_start[e.b+1];
+	}
+	for (size_t n = 0; n < nodes.size(); ++n)
+		mesh.edge_start[n+1] += mesh.edge_start[n];
+
+	std::pmr::vector<uint32_t> fill(mesh.edge_start.begin(), mesh.edge_start.end() - 1, arena);
+	std::pmr::vector<Mesh::node_t> origin(mesh.edge_start.back(), arena);
+	std::pmr::map<std::pair<id_t, id_t>, uint32_t> pair_ids(arena);
+	mesh.half_edge.resize(mesh.edge_start.back());
+	mesh.edge_pair.reserve(edges.size());
+	for (const auto &[s, t, c1, c2] : edges) {
+		assert(s < t);
+		const auto [pair, added] = pair_ids.try_emplace({ c1, c2 }, mesh.pairs.size());
+		if (added)
+			mesh.pairs.push_back(Mesh::ClusterPair{ c1, c2 });
+		const Mesh::edge_t edge = mesh.edge_pair.size();
+		mesh.edge_pair.push_back(pair->second);
+		origin[fill[s]] = s;
+		origin[fill[t]] = t;
+		mesh.half_edge[fill[s]++] = Mesh::HalfEdge{ t, edge };
+		mesh.half_edge[fill[t]++] = Mesh::HalfEdge{ s, edge };
+	}
+
+	TRACE_NEXT(phase, "assembleMesh: faces");
+	const auto face_of = [&] (size_t h) {
+		const auto pair = mesh.separates(mesh.half_edge[h]);
+		return origin[h] < mesh.half_edge[h].to ? pair.clust1 : pair.clust2;
+	};
+	// A cluster meets a node at most once, corners where a diagonal would
+	// pinch it being split in two, so the face continues through the only
+	// half-edge leaving the node with the same cluster.
+	mesh.next.resize(mesh.half_edge.size());
+	for (size_t h = 0; h < mesh.half_edge.size(); ++h) {
+		const auto to = mesh.half_edge[h].to;
+		const auto cluster = face_of(h);
+		mesh.next[h] = uint32_t(-1);
+		for (auto out = mesh.edge_start[to]; out < mesh.edge_start[to+1]; ++out) {
+			if (face_of(out) == cluster) {
+				assert(mesh.next[h] == uint32_t(-1));
+				mesh.next[h] = out;
+			}
+		}
+		assert(mesh.next[h] != uint32_t(-1));
+	}
+
+	mesh.cluster_id = std::move(cluster_id);
+	mesh.face.assign(mesh.half_edge.size(), uint32_t(-1));
+	mesh.face_start.push_back(0);
+	for (size_t first = 0; first < mesh.half_edge.size(); ++first) {
+		if (mesh.face[first] != uint32_t(-1))
+			continue;
+		const uint32_t f = mesh.face_cluster.size();
+		for (auto h = first; mesh.face[h] == uint32_t(-1); h = mesh.next[h]) {
+			mesh.face[h] = f;
+			mesh.face_node.push_back(origin[h]);
+		}
+		mesh.face_cluster.push_back(face_of(first));
+		mesh.face_start.push_back(mesh.face_node.size());
+	}
+
+	TRACE_NEXT(phase, "assembleMesh: preview");
+	while (preview && preview->clear() && !preview->advance()) {
+		preview->submit(lines, vec4<float>(1.0f, 1.0f, 1.0f, 1.0f));
+		preview->draw();
+	}
+
+	mesh.vert = std::move(nodes);
+	mesh.node_cluster_ids = std::move(node_cluster_ids);
+	return mesh;
+}
+
+template <size_t ARITY>
+Mesh buildShapesOf(Clusters& clusters, size_t width, size_t height, Preview *preview)
+{
+	using Side = ::Side<ARITY>;
+	static constexpr size_t STEPS = Side::STEPS;
+	TRACE_SCOPE("buildShapes");
+	TRACE_PHASE(phase, "buildShapes: sides");
+
+	// every temporary below lives in one arena, released in one go on return
+	std::pmr::monotonic_buffer_resource arena(width * height * sizeof(vec2<float>));
+
+	const auto labels = clusters.labels();
+	assert(labels.width == width && labels.height == height);
+
+	// interior and transparent pixels have no sides to outline
+	std::pmr::vector<Side> sides(&arena);
+	const auto masks = sideMasks(labels, &arena);
+	for (const auto pixel : masks.boundary) {
+		const size_t x = pixel % width;
+		const size_t y = pixel / width;
+		for (size_t o = 0; o < std::size(side_offset); ++o) {
+			if (masks.mask[pixel] >> o & 1)
+				sides.emplace_back(labels, x, y, o);
+		}
+	}
+
+	TRACE_NEXT(phase, "buildShapes: lattice");
+	const Lattice<ARITY> lattice(labels);
+	std::pmr::vector<id_t> node_of(lattice.size(), id_t(-1), &arena);
+
+	std::pmr::vector<std::array<size_t, ARITY + 2>> keys(&arena);
+	keys.reserve(sides.size());
+	size_t node_count = 0;
+	for (const auto &side : sides) {
+		keys.push_back(lattice.side_keys(side));
+		for (const auto key : keys.back()) {
+			node_count += node_of[key] == id_t(-1);
+			node_of[key] = 0;
+		}
+	}
+	std::fill(node_of.begin(), node_of.end(), id_t(-1));
+
+	// edge nodes are numbered before corner nodes, each in order of their first side
+	std::vector<vec2<float>> nodes;
+	std::vector<ClusterSet> node_cluster_ids;
+	nodes.reserve(node_count);
+	node_cluster_ids.reserve(node_count);
+	const auto node_at = [&] (size_t key, vec2<size_t> l, id_t compact) {
+		auto &node = node_of[key];
+		if (node == id_t(-1)) {
+			node = nodes.size();
+			nodes.emplace_back(float(l.x) / STEPS, float(l.y) / STEPS);
+			node_cluster_ids.emplace_back();
+		}
+		node_cluster_ids[node].insert(compact);
+		return node;
+	};
+	for (size_t s = 0; s < sides.size(); ++s) {
+		for (size_t edge_node = 0; edge_node < ARITY; ++edge_node)
+			node_at(keys[s][edge_node], sides[s].at(edge_node+1), sides[s].current);
+	}
+	for (size_t s = 0; s < sides.size(); ++s) {
+		node_at(keys[s][ARITY], sides[s].start, sides[s].current);
+		node_at(keys[s][ARITY+1], sides[s].at(STEPS), sides[s].current);
+	}
+	assert(nodes.size() == node_count);
+
+	// edge between s and t and max(s,t) in edges[min(s,t)], kept from the first side through it;
+	// sides are walked with their own pixel as the face
+	std::pmr::map<size_t, std::pmr::set<EdgeEnd>> edges(&arena);
+	const auto link = [&] (size_t a, size_t b, Side const &side) {
+		const auto [min, max] = std::minmax<size_t>({ node_of[a], node_of[b] });
+		assert(min != max);
+		if (min == node_of[a])
+			edges[min].emplace(max, side.current, side.neighbr);
+		else
+			edges[min].emplace(max, side.neighbr, side.current);
+	};
+	for (size_t s = 0; s < sides.size(); ++s) {
+		const auto &key = keys[s];
+		link(key[ARITY], key[0], sides[s]);
+		for (size_t edge_node = 0; edge_node < ARITY-1; ++edge_node) {
+			link(key[edge_node], key[edge_node+1], sides[s]);
+		}
+		link(key[ARITY-1], key[ARITY+1], sides[s]);
+	}
+
+	std::pmr::vector<EdgeRecord> records(&arena);
+	for (const auto &[s, neighbrs] : edges) {
+		for (const auto [t, c1, c2] : neighbrs)
+			records.push_back(EdgeRecord{ Mesh::node_t(s), Mesh::node_t(t), c1, c2 });
+	}
+
+	TRACE_NEXT(phase, "buildShapes: assemble");
+	return assembleMesh(std::move(nodes), std::move(node_cluster_ids), records, labels.cluster, &arena, preview);
+}
+
+template <size_t ARITY>
+Mesh traceShapesOf(Clusters& clusters, size_t width, size_t height, Preview *preview)
+{
+	using Side = ::Side<ARITY>;
+	static constexpr size_t STEPS = Side::STEPS;
+	TRACE_SCOPE("traceShapes");
+	TRACE_PHASE(phase, "traceShapes: contours");
+	std::pmr::monotonic_buffer_resource arena(width * height * sizeof(vec2<float>));
+
+	const auto labels = clusters.labels();
+	assert(labels.width == width && labels.height == height);
+	const auto masks = sideMasks(labels, &arena);
+	const Lattice<ARITY> lattice(labels);
+	std::pmr::vector<id_t> node_of(lattice.size(), id_t(-1), &arena);
+	// sides already walked, bits as in masks.mask
+	std::pmr::vector<uint8_t> walked(masks.mask.size(), 0, &arena);
+
+	std::vector<vec2<float>> nodes;
+	std::vector<ClusterSet> node_cluster_ids;
+	const auto node_at = [&] (size_t key, vec2<size_t> l, id_t compact) {
+		auto &node = node_of[key];
+		if (node == id_t(-1)) {
+			node = nodes.size();
+			nodes.emplace_back(float(l.x) / STEPS, float(l.y) / STEPS);
+			node_cluster_ids.emplace_back();
+		}
+		node_cluster_ids[node].insert(compact);
+		return Mesh::node_t(node);
+	};
+
+	// Both sides of an edge between two clusters are walked, the one of the
+	// lower cluster records it; edges to the outside are only walked once.
+	std::pmr::vector<EdgeRecord> edges(&arena);
+	const auto link = [&] (Mesh::node_t a, Mesh::node_t b, Side const &side) {
+		if (side.current > side.neighbr)
+			return;
+		if (a < b)
+			edges.push_back(EdgeRecord{ a, b, side.current, side.neighbr });
+		else
+			edges.push_back(EdgeRecord{ b, a, side.neighbr, side.current });
+	};
+
+	// Every ring is walked once, starting from its first side in raster
+	// order, as a chain of corner and edge nodes. A ring continues at its
+	// end corner with the side of the same cluster leaving that corner node:
+	// where a diagonal splits the corner the node is only shared by the
+	// sides on one side of it, so the choice is always unique.
+	for (const auto pixel : masks.boundary) {
+		for (size_t first = 0; first < std::size(side_offset); ++first) {
+			if (!(masks.mask[pixel] >> first & 1) || walked[pixel] >> first & 1)
+				continue;
+			size_t x = pixel % width;
+			size_t y = pixel / width;
+			size_t o = first;
+			do {
+				walked[x + y * width] |= 1 << o;
+				const Side side(labels, x, y, o);
+				auto from = node_at(lattice.corner_key(side.start, o, 0), side.start, side.current);
+				for (size_t step = 1; step < STEPS; ++step) {
+					const auto l = side.at(step);
+					const auto to = node_at(lattice.edge_key(l), l, side.current);
+					link(from, to, side);
+					from = to;
+				}
+				const auto end = side.at(STEPS);
+				const auto end_key = lattice.corner_key(end, o, 1);
+				link(from, node_at(end_key, end, side.current), side);
+
+				const size_t cx = end.x / STEPS;
+				const size_t cy = end.y / STEPS;
+				size_t next = std::size(side_offset);
+				for (size_t n = 0; n < std::size(side_offset); ++n) {
+					const size_t nx = cx - side_offset[n].start.x;
+					const size_t ny = cy - side_offset[n].start.y;
+					if (nx < width && ny < height && labels.at(nx, ny) == side.current
+					    && masks.mask[nx + ny * width] >> n & 1
+					    && lattice.corner_key(end, n, 0) == end_key) {
+						next = n;
+						x = nx;
+						y = ny;
+						break;
+					}
+				}
+				assert(next < std::size(side_offset));
+				o = next;
+			} while (x + y * width != pixel || o != first);
+		}
+	}
+
+	TRACE_NEXT(phase, "traceShapes: assemble");
+	return assembleMesh(std::move(nodes), std::move(node_cluster_ids), edges, labels.cluster, &arena, preview);
+}
+
+
+// half-edges of the chain leaving u through first, up to the first node not inside it
+template <typename Inside>
+void followChain(Mesh const &mesh, Mesh::node_t u, Mesh::HalfEdge first, Inside &&inside,
+	std::pmr::vector<Mesh::HalfEdge> &chain)
+{
+	chain.assign(1, first);
+	for (auto prev = u; inside(chain.back().to); ) {
+		const auto at = chain.back().to;
+		const auto adj = mesh.neighbours(at);
+		assert(adj.size() == 2);
+		chain.push_back(adj[0].to == prev ? adj[1] : adj[0]);
+		prev = at;
+	}
+}
+
+// The mesh without the removed nodes, all of which have two neighbours. A
+// stretch of them becomes one edge between the kept nodes at its ends, and
+// its nodes are put back at their share of the span of the stretch.
+Decimation collapse(Mesh const &mesh, std::span<const uint8_t> removed, std::pmr::memory_resource *arena)
+{
+	const size_t n_nodes = mesh.vert.size();
+	const auto span_of = [&] (Mesh::HalfEdge h) {
+		return mesh.edge_span.empty() ? 1u : mesh.edge_span[h.edge];
+	};
+
+	Decimation out;
+	out.full.resize(n_nodes);
+	std::pmr::vector<Mesh::node_t> coarse(n_nodes, Mesh::node_t(-1), arena);
+	std::vector<vec2<float>> nodes;
+	std::vector<ClusterSet> node_cluster_ids;
+	for (Mesh::node_t u = 0; u < n_nodes; ++u) {
+		if (removed[u])
+			continue;
+		coarse[u] = nodes.size();
+		out.full[u] = Decimation::Interpolant{ coarse[u], coarse[u], 0.0f };
+		nodes.push_back(mesh.vert[u]);
+		node_cluster_ids.push_back(mesh.node_cluster_ids[u]);
+	}
+
+	// Every ring keeps some nodes, so every stretch ends in kept nodes at
+	// both ends. It is followed from the end with the lower coarse index.
+	std::pmr::vector<EdgeRecord> edges(arena);
+	std::vector<uint32_t> edge_span;
+	std::pmr::vector<Mesh::HalfEdge> stretch(arena);
+	for (Mesh::node_t u = 0; u < n_nodes; ++u) {
+		if (removed[u])
+			continue;
+		for (const auto first : mesh.neighbours(u)) {
+			followChain(mesh, u, first, [&] (Mesh::node_t v) { return removed[v]; }, stretch);
+			const auto end = stretch.back().to;
+			if (coarse[u] > coarse[end])
+				continue;
+			assert(coarse[u] != coarse[end]);
+			uint32_t span = 0;
+			for (const auto h : stretch)
+				span += span_of(h);
+			uint32_t along = 0;
+			for (size_t step = 0; step + 1 < stretch.size(); ++step) {
+				along += span_of(stretch[step]);
+				out.full[stretch[step].to] = Decimation::Interpolant{ coarse[u], coarse[end], float(along) / span };
+			}
+			const auto pair = mesh.separates(first);
+			const bool upward = u < first.to;
+			edges.push_back(EdgeRecord{ coarse[u], coarse[end],
+				upward ? pair.clust1 : pair.clust2, upward ? pair.clust2 : pair.clust1 });
+			edge_span.push_back(span);
+		}
+	}
+
+	out.mesh = assembleMesh(std::move(nodes), std::move(node_cluster_ids), edges, mesh.cluster_id, arena, nullptr);
+	out.mesh.edge_span = std::move(edge_span);
+	return out;
+}
+
+}
+
+Mesh buildShapes(Clusters& clusters, size_t width, size_t height, Preview *preview, size_t arity)
+{
+	static constexpr decltype(&buildShapesOf<1>) of_arity[] = {
+		buildShapesOf<1>, buildShapesOf<2>, buildShapesOf<3>, buildShapesOf<4>,
+	};
+	static_assert(std::size(of_arity) == max_arity);
+	assert(arity >= 1 && arity <= max_arity);
+	return of_arity[arity - 1](clusters, width, height, preview);
+}
+
+Mesh traceShapes(Clusters& clusters, size_t width, size_t height, Preview *preview, size_t arity)
+{
+	static constexpr decltype(&traceShapesOf<1>) of_arity[] = {
+		traceShapesOf<1>, traceShapesOf<2>, traceShapesOf<3>, traceShapesOf<4>,
+	};
+	static_assert(std::size(of_arity) == max_arity);
+	assert(arity >= 1 && arity <= max_arity);
+	return of_arity[arity - 1](clusters, width, height, preview);
+}
+
+Decimation decimateCollinear(Mesh const &mesh, float margin)
+{
+	TRACE_SCOPE("decimateCollinear");
+	const size_t n_nodes = mesh.vert.size();
+	std::pmr::monotonic_buffer_resource arena(n_nodes * sizeof(Mesh::node_t));
+
+	// Pixel sides are axis aligned, so a node lies inside a straight run
+	// exactly when both its neighbours share one of its coordinates.
+	const auto straight = [&] (Mesh::node_t u) -> bool {
+		const auto adj = mesh.neighbours(u);
+		if (adj.size() != 2)
+			return false;
+		const auto p = mesh.vert[adj[0].to], q = mesh.vert[adj[1].to], v = mesh.vert[u];
+		return (p.x == v.x && q.x == v.x) || (p.y == v.y && q.y == v.y);
+	};
+
+	// the outline bends near the ends of a run, only the nodes further in stay straight
+	std::pmr::vector<uint8_t> removed(n_nodes, 0, &arena);
+	std::pmr::vector<Mesh::HalfEdge> run(&arena);
+	for (Mesh::node_t u = 0; u < n_nodes; ++u) {
+		if (straight(u))
+			continue;
+		for (const auto first : mesh.neighbours(u)) {
+			followChain(mesh, u, first, straight, run);
+			const auto end = run.back().to;
+			if (u > end)
+				continue;
+			for (size_t step = 0; step + 1 < run.size(); ++step) {
+				const auto at = run[step].to;
+				removed[at] = (mesh.vert[at] - mesh.vert[u]).length() > margin
+				           && (mesh.vert[at] - mesh.vert[end]).length() > margin;
+			}
+		}
+	}
+	return collapse(mesh, removed, &arena);
+}
+
+std::vector<Decimation> coarsenLevels(Mesh const &mesh, size_t min_nodes)
+{
+	TRACE_SCOPE("coarsenLevels");
+	std::vector<Decimation> levels;
+	for (Mesh const *fine = &mesh; fine->vert.size() >= 2 * min_nodes; fine = &levels.back().mesh) {
+		const size_t n_nodes = fine->vert.size();
+		std::pmr::monotonic_buffer_resource arena(n_nodes * sizeof(Mesh::node_t));
+
+		// Every other node along a chain goes: a removed node has two kept
+		// neighbours, which must not be joined already, by an edge of the
+		// fine mesh or by another removed node.
+		std::pmr::vector<uint8_t> removed(n_nodes, 0, &arena);
+		std::pmr::vector<uint8_t> kept(n_nodes, 0, &arena);
+		std::pmr::set<std::pair<Mesh::node_t, Mesh::node_t>> joined(&arena);
+		size_t count = 0;
+		for (Mesh::node_t u = 0; u < n_nodes; ++u) {
+			const auto adj = fine->neighbours(u);
+			if (adj.size() != 2 || kept[u] || removed[adj[0].to] || removed[adj[1].to])
+				continue;
+			const auto [p, q] = std::minmax(adj[0].to, adj[1].to);
+			const auto adj_p = fine->neighbours(p);
+			if (std::any_of(adj_p.begin(), adj_p.end(), [q = q] (auto h) { return h.to == q; }))
+				continue;
+			if (!joined.emplace(p, q).second)
+				continue;
+			removed[u] = 1;
+			kept[p] = kept[q] = 1;
+			++count;
+		}
+		// junctions and short rings leave too little to coarsen
+		if (count * 8 < n_nodes)
+			break;
+		levels.push_back(collapse(*fine, removed, &arena));
+	}
+	return levels;
+}
+
+std::vector<vec2<float>> Decimation::densify(std::span<const vec2<float>> pos) const
+{
+	std::vector<vec2<float>> dense;
+	dense.reserve(full.size());
+	for (const auto [a, b, t] : full)
+		dense.push_back(pos[a] * (1.0f - t) + pos[b] * t);
+	return dense;
+}
+
+std::vector<vec2<float>> Decimation::prolong(std::span<const vec2<float>> pos, std::span<const vec2<float>> rest) const
+{
+	std::vector<vec2<float>> fine;
+	fine.reserve(full.size());
+	for (size_t n = 0; n < full.size(); ++n) {
+		const auto [a, b, t] = full[n];
+		fine.push_back(rest[n] + (pos[a] - mesh.vert[a]) * (1.0f - t) + (pos[b] - mesh.vert[b]) * t);
+	}
+	return fine;
+}
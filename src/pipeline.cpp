@@ -0,0 +1,186 @@
+#include "pipeline.hpp"
+#include <algorithm>
+#include <cmath>
+
+void Pipeline::invalidate(stage from)
+{
+	switch (from) {
+	case Clustering:
+		cached_clusters.reset();
+		[[fallthrough]];
+	case Meshing:
+		cached_mesh.reset();
+		[[fallthrough]];
+	case Boundaries:
+		cached_boundaries.reset();
+		[[fallthrough]];
+	case Modelling:
+		cached_model.reset();
+		[[fallthrough]];
+	case Smoothing:
+		cached_smoothed.reset();
+	}
+}
+
+bool Pipeline::cached(stage s) const
+{
+	switch (s) {
+	case Clustering: return cached_clusters.has_value();
+	case Meshing:    return cached_mesh.has_value();
+	case Boundaries: return cached_boundaries.has_value();
+	case Modelling:  return cached_model.has_value();
+	case Smoothing:  return cached_smoothed.has_value();
+	}
+	return false;
+}
+
+void Pipeline::setClusterThreshold(int value)
+{
+	if (value != delta_c) {
+		delta_c = value;
+		invalidate(Clustering);
+	}
+}
+
+void Pipeline::setSprings(float local, float neighbour)
+{
+	if (local != k0 || neighbour != kN) {
+		k0 = local;
+		kN = neighbour;
+		invalidate(Smoothing);
+	}
+}
+
+Clusters &Pipeline::clusters()
+{
+	if (!cached_clusters) {
+		cached_clusters.emplace(image, sweep, delta_c);
+	}
+	return *cached_clusters;
+}
+
+std::vector<size_t> const &Pipeline::components()
+{
+	if (!cached_components) {
+		cached_components = sweep.components(256);
+	}
+	return *cached_components;
+}
+
+Mesh &Pipeline::mesh()
+{
+	if (!cached_mesh) {
+		cached_mesh = buildShapes(clusters(), image.width, image.height, preview);
+	}
+	return *cached_mesh;
+}
+
+BoundaryGraph &Pipeline::boundaries()
+{
+	if (!cached_boundaries) {
+		cached_boundaries = clusterBoundaries(mesh(), preview);
+	}
+	return *cached_boundaries;
+}
+
+ForceModel &Pipeline::model()
+{
+	if (!cached_model) {
+		cached_model = buildForceModel(mesh());
+	}
+	return *cached_model;
+}
+
+std::vector<vec2<float>> &Pipeline::smoothed()
+{
+	if (!cached_smoothed) {
+		cached_smoothed = applyForces(model(), k0, kN);
+	}
+	return *cached_smoothed;
+}
+
+bool Pipeline::setSmoothed(std::vector<vec2<float>> vert, float local, float neighbour)
+{
+	if (local != k0 || neighbour != kN)
+		return false;
+	cached_smoothed = std::move(vert);
+	return true;
+}
+
+Simulation::Simulation(ForceModel const &model, float k0, float kN)
+	: model(model), solver(this->model), k0(k0), kN(kN)
+{
+	worker = std::thread([this] { run(); });
+}
+
+Simulation::~Simulation()
+{
+	cancel();
+	worker.join();
+}
+
+void Simulation::publish()
+{
+	const auto state = frame_state.load(std::memory_order_acquire);
+	if (state & FramePending)
+		return;
+	const unsigned back = (state & FrontIndex) ^ 1;
+	frames[back] = solver.vert;
+	frame_state.store(back | FramePending, std::memory_order_release);
+}
+
+void Simulation::run()
+{
+	while (!cancelled.load(std::memory_order_relaxed)) {
+		paused.wait(true);
+		if (cancelled.load(std::memory_order_relaxed))
+			break;
+		const float local = k0.load(std::memory_order_relaxed);
+		const float neighbour = kN.load(std::memory_order_relaxed);
+		const float force = solver.step(local, neighbour);
+		if (iterations.fetch_add(1, std::memory_order_relaxed) == 0)
+			initial_force.store(force, std::memory_order_relaxed);
+		max_force.store(force, std::memory_order_relaxed);
+		publish();
+		// settled only if the springs did not change during the sweep
+		if (force <= force_threshold && local == k0.load(std::memory_order_relaxed)
+		    && neighbour == kN.load(std::memory_order_relaxed)) {
+			settled_k0 = local;
+			settled_kN = neighbour;
+			break;
+		}
+	}
+	finished.store(true, std::memory_order_release);
+}
+
+void Simulation::setSprings(float local, float neighbour)
+{
+	k0.store(local, std::memory_order_relaxed);
+	kN.store(neighbour, std::memory_order_relaxed);
+}
+
+void Simulation::pause()
+{
+	paused.store(true);
+}
+
+void Simulation::resume()
+{
+	paused.store(false);
+	paused.notify_all();
+}
+
+void Simulation::cancel()
+{
+	cancelled.store(true);
+	resume();
+}
+
+float Simulation::progress() const
+{
+	const float start = initial_force.load(std::memory_order_relaxed);
+	const float now   = max_force.load(std::memory_order_relaxed);
+	if (start <= force_threshold || now <= 0.0f)
+		return isFinished() ? 1.0f : 0.0f;
+	return std::clamp(std::log(start / now) / std::log(start / force_threshold), 0.0f, 1.0f);
+}
@@ -0,0 +1,81 @@
+#include "mesh.hpp"
+#include "trace.hpp"
+#include <cassert>
+#include <cstdio>
+#include <deque>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+static std::ostream &operator<<(std::ostream &os, Color color)
+{
+	char buf[7];
+	std::sprintf(buf, "%02x%02x%02x", color.r, color.g, color.b);
+	return os << buf;
+}
+
+static std::string serializeSVG(Color color, Boundary const &bnd, std::vector<vec2<float>> const &pos)
+{
+	std::stringstream result;
+	result << "\t<g fill=\"#" << color << "\">\n";
+	for (const auto &[_, outer] : bnd.polys) {
+		result << "\t\t<polygon points=\"";
+		bool first = true;
+		for (const auto i : outer) {
+			if (first) {
+				first = false;
+			} else {
+				result << ' ';
+			}
+			auto out = pos[i] * 25.0f;
+			result << out.x << ',' << out.y;
+		}
+		result << "\"/>\n";
+	}
+	result << "\t</g>\n";
+	return result.str();
+}
+
+std::string serializeShapes(Clusters const &clusters, BoundaryGraph const &bnd, std::vector<vec2<float>> const &pos)
+{
+	TRACE_SCOPE("serializeShapes");
+	std::stringstream result;
+	std::deque<id_t> dfs;
+	// starts from the image boundary, absent when every pixel is transparent
+	if (bnd.contains(id_t(-1)))
+		dfs.push_back(id_t(-1));
+	std::set<id_t> seen;
+	while (!dfs.empty()) {
+		const auto s = dfs.back();
+		dfs.pop_back();
+		if (seen.contains(s))
+			continue;
+		seen.emplace(s);
+		const auto boundary = bnd.find(s);
+		assert(boundary != bnd.end());
+		if (s != id_t(-1)) {
+			result << serializeSVG(clusters.average_color(s), boundary->second, pos);
+		}
+		for (const auto &t : boundary->second.adj) {
+			dfs.push_back(t);
+		}
+	}
+	return result.str();
+}
+
+std::string serializeSVG(std::string_view shapes)
+{
+	std::string result;
+	result += R"(<?xml version="1.0"?>)" "\n";
+	result += R"(<svg width="600" height="600" viewBox="-100 -100 700 700" xmlns="http://www.w3.org/2000/svg">)" "\n";
+	result += shapes;
+	result += "</svg>\n";
+	return result;
+}
+
+std::string serializeSVG(Clusters const &clusters, BoundaryGraph const &bnd, std::vector<vec2<float>> const &pos)
+{
+	TRACE_SCOPE("serializeSVG");
+	return serializeSVG(serializeShapes(clusters, bnd, pos));
+}
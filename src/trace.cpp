@@ -0,0 +1,103 @@
+#include "trace.hpp"
+
+#ifdef DEPIXEL_TRACE
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+struct Event
+{
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+};
+
+// Once full, a buffer keeps only the most recent events.
+struct Buffer
+{
+	static constexpr size_t capacity = size_t{1} << 16;
+
+	std::array<Event, capacity> events;
+	std::atomic<uint64_t> head{0};
+	unsigned tid;
+};
+
+// Buffers are owned here and outlive their threads, so events of finished
+// workers still reach the dump.
+struct Registry
+{
+	std::mutex lock;
+	std::vector<std::unique_ptr<Buffer>> buffers;
+	uint64_t epoch = now();
+
+	Buffer *add()
+	{
+		std::lock_guard guard(lock);
+		buffers.push_back(std::make_unique<Buffer>());
+		buffers.back()->tid = unsigned(buffers.size());
+		return buffers.back().get();
+	}
+};
+
+Registry registry;
+
+// declared after the registry so it is destroyed first
+struct DumpOnExit
+{
+	~DumpOnExit()
+	{
+		const char *path = std::getenv("DEPIXEL_TRACE_FILE");
+		dump(path ? path : "trace.json");
+	}
+} dump_on_exit;
+
+thread_local Buffer *local = nullptr;
+
+}
+
+void record(const char *name, uint64_t start, uint64_t end)
+{
+	if (!local) {
+		local = registry.add();
+	}
+	const auto at = local->head.load(std::memory_order_relaxed);
+	local->events[at % Buffer::capacity] = Event{ name, start, end };
+	local->head.store(at + 1, std::memory_order_release);
+}
+
+void dump(const char *path)
+{
+	std::ofstream out(path);
+	out << std::fixed << std::setprecision(3);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+	std::lock_guard guard(registry.lock);
+	for (const auto &buffer : registry.buffers) {
+		const auto head  = buffer->head.load(std::memory_order_acquire);
+		const auto begin = head > Buffer::capacity ? head - Buffer::capacity : 0;
+		for (auto at = begin; at < head; ++at) {
+			const auto &event = buffer->events[at % Buffer::capacity];
+			// Chrome trace timestamps are microseconds
+			const auto ts  = double(event.start - registry.epoch) / 1000.0;
+			const auto dur = double(event.end - event.start) / 1000.0;
+			out << (first ? "" : ",\n")
+			    << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+			    << ",\"ts\":" << ts << ",\"dur\":" << dur << "}";
+			first = false;
+		}
+	}
+	out << "\n]}\n";
+}
+
+}
+
+#endif